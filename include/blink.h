@@ -10,6 +10,23 @@
 #define BLINK_FALSE 0
 #define BLINK_STRING_MAX 128
 
+// The version of this header. Hosts and plugins tell each other which
+// version they were built against with blink_exchange_api_version(), and
+// each must treat anything added after the other's version as absent.
+//
+//   1 - Anything built before versions were exchanged
+//   2 - blink_SamplerInfo::draws_peaks
+//       blink_SampleInfo::channel_data, get_data_raw and read_ahead
+//       blink_SamplerDrawInfo::peak_min, peak_max and peak_rms
+//       blink_VaryingData::ramp (which moves the fields after
+//       blink_SamplerVaryingData::base)
+//       blink_sampler_draw_stream()
+//       blink_sampler_get_sonic_fragment_at_block_position()
+//       blink_sampler_block_position_for_sonic_fragment()
+//
+// blink/compat.hpp converts to and from the version 1 layouts.
+#define BLINK_API_VERSION 2
+
 typedef int      blink_Error;
 typedef double   blink_Position;
 typedef uint32_t blink_Scale;
@@ -295,6 +312,10 @@ typedef struct {
 	// by blink_sampler_draw(). If this is true then Blockhead will
 	// draw a second waveform for the baked block data.
 	blink_Bool baked_waveform_could_be_different;
+	// True if blink_sampler_draw() fills in the peak outputs of
+	// blink_SamplerDrawInfo. If this is false the host has to find the
+	// peaks from the sample data itself. Since version 2.
+	blink_Bool draws_peaks;
 } blink_SamplerInfo;
 
 typedef blink_EnvIdx        (*blink_host_add_env)(void*);
@@ -407,6 +428,14 @@ typedef struct {
 } blink_AnalysisCallbacks;
 
 typedef blink_FrameCount (*blink_GetSampleDataCB)(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer);
+// Like blink_GetSampleDataCB but writes frames in the sample's native
+// integer format, as given by blink_SampleInfo::bit_depth:
+//   16 - int16_t
+//   24 - packed signed little-endian, 3 bytes per frame
+typedef blink_FrameCount (*blink_GetSampleDataRawCB)(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, void* buffer);
+// Hint that frames from beg to end are likely to be read soon. Must not
+// block.
+typedef void (*blink_ReadAheadCB)(void* host, blink_FrameCount beg, blink_FrameCount end);
 
 typedef struct {
 	blink_ID id;
@@ -419,6 +448,23 @@ typedef struct {
 	blink_BitDepth bit_depth; 
 	void* host;
 	blink_GetSampleDataCB get_data;
+	// Optional. If the sample is fully resident in memory the host can
+	// point this at an array of num_channels pointers, each to num_frames
+	// contiguous frames, so plugins can read the data directly instead of
+	// calling get_data(). The pointers must remain valid until
+	// blink_sampler_sample_deleted() is called for this sample.
+	// Null if the data is not directly accessible. Since version 2, as
+	// are the rest of these.
+	const float* const* channel_data;
+	// Optional. For 16 and 24 bit samples the host can provide this so
+	// that it doesn't have to keep the sample data expanded to floats.
+	// Plugins will use it in preference to get_data() but get_data() must
+	// still be provided. Null if not supported.
+	blink_GetSampleDataRawCB get_data_raw;
+	// Optional. If the sample is streamed from disk, plugins can call this
+	// to ask for frames to be made resident ahead of time. Frames which
+	// are not resident yet are read as silence. Null if not supported.
+	blink_ReadAheadCB read_ahead;
 } blink_SampleInfo;
 
 typedef struct {
@@ -457,8 +503,71 @@ typedef struct {
 	float* waveform_derivatives; 
 	// The amplitude after being transformed by parameter settings
 	float* amp;
+	// The lowest and highest sample values, and the RMS, over the frames
+	// each pixel covers after every transformation. For plugins which keep
+	// a peak pyramid, so that the host doesn't have to read the sample
+	// data for every pixel itself. Each is an array of n values per
+	// channel, with channel c starting at [c * n].
+	// Only filled in if blink_SamplerInfo.draws_peaks is true. Since
+	// version 2.
+	float* peak_min;
+	float* peak_max;
+	float* peak_rms;
 } blink_SamplerDrawInfo;
 
+// Which outputs blink_sampler_draw_stream() should produce. One for each
+// array in blink_SamplerDrawInfo, in the same order.
+typedef enum {
+	blink_SamplerDrawOutput_SculptedSamplePositions = 1 << 0,
+	blink_SamplerDrawOutput_WarpedSamplePositions   = 1 << 1,
+	blink_SamplerDrawOutput_SculptedBlockPositions  = 1 << 2,
+	blink_SamplerDrawOutput_WarpedBlockPositions    = 1 << 3,
+	blink_SamplerDrawOutput_FinalSamplePositions    = 1 << 4,
+	blink_SamplerDrawOutput_WaveformDerivatives     = 1 << 5,
+	blink_SamplerDrawOutput_Amp                     = 1 << 6,
+	blink_SamplerDrawOutput_PeakMin                 = 1 << 7,
+	blink_SamplerDrawOutput_PeakMax                 = 1 << 8,
+	blink_SamplerDrawOutput_PeakRMS                 = 1 << 9,
+} blink_SamplerDrawOutput;
+
+// The position outputs of blink_SamplerDrawInfo, as floats
+typedef struct {
+	float* sculpted_sample_positions;
+	float* warped_sample_positions;
+	float* sculpted_block_positions;
+	float* warped_block_positions;
+	float* final_sample_positions;
+} blink_SamplerDrawPositionsF32;
+
+// The pixels [first, first + count) of a streamed draw. The arrays
+// belong to the plugin and are only valid until the sink returns.
+typedef struct {
+	uint64_t first;
+	blink_FrameCount count;
+	// As if blink_sampler_draw() had been called for just these pixels,
+	// so the peak channels are [count] apart. Anything that wasn't asked
+	// for is null. The positions are also null if they were asked for as
+	// floats.
+	blink_SamplerDrawInfo data;
+	// Only set if blink_SamplerDrawStream.float_positions is true
+	blink_SamplerDrawPositionsF32 float_data;
+} blink_SamplerDrawChunk;
+
+// Return BLINK_FALSE to stop the draw early
+typedef blink_Bool (*blink_SamplerDrawSink)(void* user, const blink_SamplerDrawChunk* chunk);
+
+typedef struct {
+	// blink_SamplerDrawOutput flags
+	uint32_t outputs;
+	// Pass the positions as floats rather than doubles. Not every frame
+	// can be told apart past 2^24 frames.
+	blink_Bool float_positions;
+	// The most pixels in one chunk. Zero lets the plugin choose.
+	blink_FrameCount chunk_size;
+	void* user;
+	blink_SamplerDrawSink sink;
+} blink_SamplerDrawStream;
+
 typedef struct {
 	// Blockhead uses these values to inform the user of any latency introduced
 	// by the block due to buffering or whatever. Latency compensation is
@@ -480,12 +589,26 @@ typedef struct {
 	int approximate_delay; // Approximate latency (in frames)
 } blink_EffectInstanceInfo;
 
+// Block positions which go up by a constant step, i.e.
+// positions[i] == start + (i * step) for i < count
+typedef struct {
+	blink_Position start;
+	blink_Position step;
+	// Zero if the positions aren't a ramp
+	int count;
+} blink_PositionRamp;
+
 typedef struct {
 	// Increments by 1 each processing vector
 	blink_VectorID vector_id;
 	// Where are we relative to the left edge of the block?
 	blink_Position* positions;
 	blink_VaryingParamData param_data;
+	// Optional. The host can fill this in during normal playback, when
+	// the positions are evenly spaced, so that the plugin can skip a lot
+	// of per-frame work. The positions must still be filled in either way.
+	// Since version 2.
+	blink_PositionRamp ramp;
 } blink_VaryingData;
 
 typedef struct {
@@ -527,6 +650,12 @@ typedef struct {
 
 extern "C"
 {
+	// Optional, but every plugin built against version 2 or later should
+	// export it. Called by the host before blink_init() with the
+	// BLINK_API_VERSION it was built against. Returns the plugin's. A
+	// plugin which doesn't export this is version 1, and a plugin for
+	// which this is never called must assume the host is.
+	EXPORTED int                      blink_exchange_api_version(int host_version);
 	EXPORTED blink_TempString         blink_get_error_string(blink_Error error);
 	EXPORTED blink_PluginInfo         blink_get_plugin_info();
 	EXPORTED blink_ResourceData       blink_get_resource_data(const char* path); // Optional
@@ -585,6 +714,23 @@ extern "C"
 	// The host takes care of actually rendering the waveform but relies on
 	// the plugin to calculate the waveform position at each pixel.
 	EXPORTED blink_Error blink_sampler_draw(const blink_SamplerVaryingData* varying, const blink_SamplerUniformData* uniform, blink_FrameCount n, blink_SamplerDrawInfo* out);
+
+	// Optional. The same as blink_sampler_draw() except that, rather than
+	// writing into arrays of [n] values allocated by the host, the plugin
+	// passes the results to stream->sink a chunk at a time, in order, on
+	// the calling thread. The memory needed doesn't grow with [n], and the
+	// host can rasterize each chunk as it arrives.
+	EXPORTED blink_Error blink_sampler_draw_stream(const blink_SamplerVaryingData* varying, const blink_SamplerUniformData* uniform, blink_FrameCount n, const blink_SamplerDrawStream* stream);
+
+	// Optional. The final sample position that blink_sampler_draw() would
+	// calculate for a single block position.
+	EXPORTED double blink_sampler_get_sonic_fragment_at_block_position(const blink_SampleInfo* sample_info, const blink_SamplerUniformData* uniform, blink_Position block_position);
+
+	// Optional. The inverse of the above, for snapping, click-to-seek,
+	// marker placement etc. If the sample position is reached more than
+	// once (e.g. because of reversal) the leftmost block position is
+	// written to [out]. Returns BLINK_FALSE if it is never reached.
+	EXPORTED blink_Bool blink_sampler_block_position_for_sonic_fragment(const blink_SampleInfo* sample_info, const blink_SamplerUniformData* uniform, double fragment, blink_Position* out);
 }
 
 #endif
@@ -2,6 +2,7 @@
 
 #include <blink.h>
 #include <limits>
+#include <optional>
 #include <snd/frame-pos.hpp>
 #pragma warning(push, 0)
 #include <DSP/MLDSPOps.h>
@@ -10,9 +11,19 @@
 namespace blink {
 
 struct BlockPositions {
+	// Positions which go up by a constant step. If this is set then
+	// positions[] isn't filled in until materialize() is called, so
+	// anything that reads positions[] directly should call that first.
+	// get() works either way.
+	struct Ramp {
+		blink_Position start;
+		blink_Position step;
+		[[nodiscard]] auto at(int index) const -> blink_Position { return start + (index * step); }
+	};
 	snd::frame_vec<64> positions;
 	snd::frame_pos prev_pos = std::numeric_limits<snd::frame_pos>::max();
 	int count = BLINK_VECTOR_SIZE;
+	std::optional<Ramp> ramp;
 	BlockPositions() {
 		positions[count - 1] = std::numeric_limits<snd::frame_pos>::max();
 	}
@@ -29,26 +40,67 @@ struct BlockPositions {
 		}
 	}
 	auto rotate_prev_pos() -> void {
-		prev_pos = positions[count - 1];
+		// Whoever calls this is about to overwrite the positions
+		prev_pos = get_last();
+		ramp.reset();
 	}
 	auto add(const blink_Position* blink_positions, int count_) -> void {
-		prev_pos = positions[count - 1]; 
+		prev_pos = get_last();
+		ramp.reset();
 		for (int i = 0; i < count_; i++) {
 			positions[i] = blink_positions[i];
 		}
 		count = count_;
 	}
 	auto add(const snd::frame_vec<64>& vec_positions, int count_) -> void {
-		prev_pos  = positions[count - 1]; 
+		prev_pos  = get_last();
+		ramp.reset();
 		positions = vec_positions;
 		count     = count_;
 	}
+	auto add(const Ramp& ramp_, int count_) -> void {
+		prev_pos      = get_last();
+		ramp          = ramp_;
+		materialized_ = false;
+		count         = count_;
+	}
+	// Uses the host's ramp descriptor if there is one
+	auto add(const blink_VaryingData& varying, int count_) -> void {
+		if (varying.ramp.count > 0 && varying.ramp.count >= count_) {
+			add(Ramp{varying.ramp.start, varying.ramp.step}, count_);
+			return;
+		}
+		add(varying.positions, count_);
+	}
+	auto materialize() -> void {
+		if (ramp && !materialized_) {
+			for (int i = 0; i < count; i++) {
+				positions[i] = ramp->at(i);
+			}
+			materialized_ = true;
+		}
+	}
+	[[nodiscard]] auto is_materialized() const -> bool {
+		return !ramp || materialized_;
+	}
+	[[nodiscard]] auto get(int index) const -> snd::frame_pos {
+		return is_materialized() ? positions[index] : ramp->at(index);
+	}
+	[[nodiscard]] auto get_last() const -> snd::frame_pos {
+		return get(count - 1);
+	}
+	// True if the positions never go backwards within the vector
+	[[nodiscard]] auto is_increasing_ramp() const -> bool {
+		return ramp && ramp->step >= 0.0;
+	}
 	auto operator[](int index) const -> snd::frame_pos {
 		if (index == -1) {
-			return prev_pos; 
+			return prev_pos;
 		}
-		return positions.at(index);
+		return is_materialized() ? positions.at(index) : ramp->at(index);
 	}
+private:
+	bool materialized_ = true;
 };
 
 } // blink
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <blink.h>
+#include <cstddef>
+#include <cstring>
+
+// Hosts and plugins built against an older blink.h don't know about
+// anything added to it since. Each side finds out which version the other
+// was built against with blink_exchange_api_version(), and uses these to
+// talk to it in its own layouts, with anything it doesn't know about
+// treated as absent.
+
+namespace blink {
+namespace compat {
+
+// The layouts of the structs which changed shape in version 2. Only
+// blink_SamplerVaryingData can't be read through the current struct,
+// because blink_VaryingData grew in the middle of it. The others just
+// gained fields at the end.
+namespace v1 {
+
+struct VaryingData {
+	blink_VectorID vector_id;
+	blink_Position* positions;
+	blink_VaryingParamData param_data;
+};
+
+struct SamplerVaryingData {
+	VaryingData base;
+	const blink_SampleInfo* sample_info;
+	blink_Bool analysis_ready;
+};
+
+} // v1
+
+// Plugin side --------------------------------------------------------
+// Plugins get these through blink::entry (see plugin_impl.hpp.)
+
+// Storage for the converted varying data of an older host
+struct SamplerVaryingData {
+	blink_SamplerVaryingData data;
+	blink_SampleInfo sample_info;
+};
+
+[[nodiscard]] inline
+auto sample_info(int host_version, const blink_SampleInfo* info, blink_SampleInfo* buffer) -> const blink_SampleInfo* {
+	if (host_version >= 2 || !info) {
+		return info;
+	}
+	*buffer = {};
+	std::memcpy(buffer, info, offsetof(blink_SampleInfo, channel_data));
+	return buffer;
+}
+
+[[nodiscard]] inline
+auto varying(int host_version, const blink_VaryingData* varying, blink_VaryingData* buffer) -> const blink_VaryingData* {
+	if (host_version >= 2) {
+		return varying;
+	}
+	*buffer = {};
+	std::memcpy(buffer, varying, sizeof(v1::VaryingData));
+	return buffer;
+}
+
+[[nodiscard]] inline
+auto varying(int host_version, const blink_SamplerVaryingData* varying, SamplerVaryingData* buffer) -> const blink_SamplerVaryingData* {
+	if (host_version >= 2) {
+		return varying;
+	}
+	const auto& old = *reinterpret_cast<const v1::SamplerVaryingData*>(varying);
+	buffer->data = {};
+	std::memcpy(&buffer->data.base, &old.base, sizeof(v1::VaryingData));
+	buffer->data.sample_info    = sample_info(host_version, old.sample_info, &buffer->sample_info);
+	buffer->data.analysis_ready = old.analysis_ready;
+	return &buffer->data;
+}
+
+// The arrays still belong to the host. The peak outputs are null.
+[[nodiscard]] inline
+auto draw_info(int host_version, blink_SamplerDrawInfo* info, blink_SamplerDrawInfo* buffer) -> blink_SamplerDrawInfo* {
+	if (host_version >= 2) {
+		return info;
+	}
+	*buffer = {};
+	std::memcpy(buffer, info, offsetof(blink_SamplerDrawInfo, peak_min));
+	return buffer;
+}
+
+// Host side ----------------------------------------------------------
+
+[[nodiscard]] inline
+auto sampler_info(int plugin_version, blink_SamplerInfo info) -> blink_SamplerInfo {
+	if (plugin_version < 2) {
+		info.draws_peaks = {BLINK_FALSE};
+	}
+	return info;
+}
+
+// What to pass to the plugin. It reads the pointer as its own layout.
+[[nodiscard]] inline
+auto plugin_varying(int plugin_version, const blink_SamplerVaryingData& varying, v1::SamplerVaryingData* buffer) -> const blink_SamplerVaryingData* {
+	if (plugin_version >= 2) {
+		return &varying;
+	}
+	std::memcpy(&buffer->base, &varying.base, sizeof(v1::VaryingData));
+	buffer->sample_info    = varying.sample_info;
+	buffer->analysis_ready = varying.analysis_ready;
+	return reinterpret_cast<const blink_SamplerVaryingData*>(buffer);
+}
+
+} // compat
+} // blink
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <blink.h>
+#include <cmath>
+#include <vector>
+#include "block_positions.hpp"
+#include "draw_stream.hpp"
+#include "peak_pyramid.hpp"
+#include "transform/tape.hpp"
+#include "worker_pool.hpp"
+
+// Helpers for implementing blink_sampler_draw().
+//
+// When zoomed in, [n] can be enormous. The pixels are split into chunks
+// which are drawn independently so they can be spread across a
+// WorkerPool. The transform tables are built once up front and every
+// chunk reads the same ones. Each chunk only has its own cursors, which
+// start from a binary search, so nothing depends on the chunks before it.
+//
+// For smooth transforms most pixels can be interpolated instead (see
+// TapeConfig::tolerance.)
+//
+// Nothing is kept between calls, so these can be called from several
+// threads at once.
+
+namespace blink {
+namespace draw {
+
+// Pixels per chunk
+static constexpr auto CHUNK_SIZE = BLINK_VECTOR_SIZE * 64;
+// Distance between the pixels which are always evaluated when
+// interpolating, so that the first pass fills whole vectors
+static constexpr auto COARSE_STRIDE = CHUNK_SIZE / BLINK_VECTOR_SIZE;
+
+struct TapeConfig {
+	transform::Tape::Config tape;
+	// Sample rate over song rate. Divides the sample positions to get the
+	// block position outputs.
+	double sr_ratio = 1.0;
+	// Needed for the peak outputs
+	const PeakPyramid* peak_pyramid = nullptr;
+	// If this is greater than zero and varying.ramp covers every pixel,
+	// the transform is only evaluated where it needs to be and the pixels
+	// in between are interpolated. No sample position output is further
+	// than this many frames from the exact value. The derivatives are
+	// interpolated too.
+	double tolerance = 0.0;
+};
+
+namespace detail {
+
+// Every stage at one pixel
+struct TapePoint {
+	blink_Position pitched;
+	blink_Position warped;
+	blink_Position reversed;
+	float pitch_ff;
+	float warp_ff;
+};
+
+// Fills in out[a + 1] to out[b - 1] on a straight line from ya to yb
+template <typename T> inline
+auto fill(T* out, uint64_t a, uint64_t b, double ya, double yb) -> void {
+	const auto slope = (yb - ya) / double(b - a);
+	for (auto i = a + 1; i < b; i++) {
+		out[i] = T(ya + (double(i - a) * slope));
+	}
+}
+
+// How far the positions in between [a] and [b] can be from the straight
+// line joining them, [distance] block frames apart, if no breakpoint is
+// crossed. Within one pitch segment the pitched positions are a convex or
+// concave function of the block position, so they can't stray from the
+// chord any further than the tangents at either end do. The warp and
+// reverse stages are linear so they only scale the error.
+[[nodiscard]] inline
+auto get_max_error(const TapePoint& a, const TapePoint& b, double distance) -> double {
+	if (distance == 0.0) {
+		return 0.0;
+	}
+	const auto slope = (b.pitched - a.pitched) / distance;
+	const auto error = std::abs(distance) * std::max(std::abs(a.pitch_ff - slope), std::abs(b.pitch_ff - slope));
+	return error * std::max({1.0, double(a.warp_ff), double(b.warp_ff)});
+}
+
+} // detail
+
+[[nodiscard]] inline
+auto get_chunk_count(uint64_t n) -> size_t {
+	return size_t((n + CHUNK_SIZE - 1) / CHUNK_SIZE);
+}
+
+template <typename DrawChunkFn> inline
+auto run_chunks(WorkerPool* pool, uint64_t n, DrawChunkFn&& draw_chunk) -> void {
+	const auto chunks = get_chunk_count(n);
+	if (pool) {
+		pool->run(chunks, draw_chunk);
+		return;
+	}
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		draw_chunk(chunk);
+	}
+}
+
+[[nodiscard]] inline
+auto wants_peaks(const blink_SamplerDrawInfo& out) -> bool {
+	return out.peak_min || out.peak_max || out.peak_rms;
+}
+
+// Fills in the peak outputs in [out] from the final sample positions.
+// Each pixel covers the frames from halfway to the previous pixel to
+// halfway to the next one, whichever way the positions are going.
+inline
+auto peaks(WorkerPool* pool, const PeakPyramid& pyramid, const double* positions, blink_FrameCount n, const blink_SamplerDrawInfo& out) -> void {
+	const auto count = n.value;
+	if (count < 1) {
+		return;
+	}
+	const auto draw_chunk = [&](size_t chunk) {
+		const auto beg = uint64_t(chunk) * CHUNK_SIZE;
+		const auto end = std::min(beg + CHUNK_SIZE, count);
+		for (auto i = beg; i < end; i++) {
+			const auto x    = positions[i];
+			const auto prev = i > 0 ? positions[i - 1] : count > 1 ? x - (positions[1] - x) : x - 1.0;
+			const auto next = i + 1 < count ? positions[i + 1] : count > 1 ? x + (x - positions[i - 1]) : x + 1.0;
+			const auto a    = (prev + x) * 0.5;
+			const auto b    = (x + next) * 0.5;
+			const auto lo   = int64_t(std::floor(std::min(a, b)));
+			const auto hi   = std::max(int64_t(std::ceil(std::max(a, b))), lo + 1);
+			for (int c = 0; c < pyramid.get_num_channels(); c++) {
+				const auto peak  = pyramid.get({uint8_t(c)}, lo, hi);
+				const auto index = (uint64_t(c) * count) + i;
+				if (out.peak_min) out.peak_min[index] = peak.min;
+				if (out.peak_max) out.peak_max[index] = peak.max;
+				if (out.peak_rms) out.peak_rms[index] = peak.rms;
+			}
+		}
+	};
+	run_chunks(pool, count, draw_chunk);
+}
+
+namespace detail {
+
+// [final_positions] is somewhere to put the final positions if the peaks
+// need them and [out] doesn't have them
+inline
+auto tape(WorkerPool* pool, const transform::Tape::Tables& tables, TapeConfig config, const blink_VaryingData& varying, blink_FrameCount n, blink_SamplerDrawInfo out, std::vector<double>* final_positions) -> void {
+	if (n.value < 1) {
+		return;
+	}
+	// The peaks are found from the final positions, so they're needed
+	// even if the host didn't ask for them
+	const auto draw_peaks = config.peak_pyramid && wants_peaks(out);
+	if (draw_peaks && !out.final_sample_positions) {
+		final_positions->resize(n.value);
+		out.final_sample_positions = final_positions->data();
+	}
+	const auto is_ramp     = varying.ramp.count > 0 && uint64_t(varying.ramp.count) >= n.value;
+	const auto interpolate = is_ramp && config.tolerance > 0.0;
+	auto& outputs = config.tape.outputs;
+	outputs.positions.pitched  = interpolate || out.sculpted_sample_positions || out.sculpted_block_positions;
+	outputs.positions.warped   = interpolate || out.warped_sample_positions || out.warped_block_positions;
+	outputs.derivatives.pitch  = interpolate || out.waveform_derivatives;
+	outputs.derivatives.warped = interpolate || out.waveform_derivatives;
+	outputs.correction_grains  = false;
+	const auto get_position = [&varying](uint64_t index) {
+		return varying.ramp.start + (double(index) * varying.ramp.step);
+	};
+	const auto add_positions = [&varying, &get_position, is_ramp](BlockPositions* block_positions, uint64_t index, int count) {
+		if (is_ramp) {
+			block_positions->add(BlockPositions::Ramp{get_position(index), varying.ramp.step}, count);
+		}
+		else {
+			block_positions->add(varying.positions + index, count);
+		}
+	};
+	const auto write_span = [&out, &config](uint64_t a, uint64_t b, const TapePoint& pa, const TapePoint& pb) {
+		if (out.sculpted_sample_positions) fill(out.sculpted_sample_positions, a, b, pa.pitched, pb.pitched);
+		if (out.sculpted_block_positions) fill(out.sculpted_block_positions, a, b, pa.pitched / config.sr_ratio, pb.pitched / config.sr_ratio);
+		if (out.warped_sample_positions) fill(out.warped_sample_positions, a, b, pa.warped, pb.warped);
+		if (out.warped_block_positions) fill(out.warped_block_positions, a, b, pa.warped / config.sr_ratio, pb.warped / config.sr_ratio);
+		if (out.final_sample_positions) fill(out.final_sample_positions, a, b, pa.reversed, pb.reversed);
+		if (out.waveform_derivatives) fill(out.waveform_derivatives, a, b, pa.pitch_ff * pa.warp_ff, pb.pitch_ff * pb.warp_ff);
+	};
+	const auto write = [&out, &config](uint64_t index, const TapePoint& point) {
+		if (out.sculpted_sample_positions) out.sculpted_sample_positions[index] = point.pitched;
+		if (out.sculpted_block_positions) out.sculpted_block_positions[index] = point.pitched / config.sr_ratio;
+		if (out.warped_sample_positions) out.warped_sample_positions[index] = point.warped;
+		if (out.warped_block_positions) out.warped_block_positions[index] = point.warped / config.sr_ratio;
+		if (out.final_sample_positions) out.final_sample_positions[index] = point.reversed;
+		if (out.waveform_derivatives) out.waveform_derivatives[index] = point.pitch_ff * point.warp_ff;
+	};
+	const auto get_point = [](const transform::Tape& tape, int i) {
+		return TapePoint{
+			tape.get_pitched_positions().positions[i],
+			tape.get_warped_positions().positions[i],
+			tape.get_reversed_positions().positions[i],
+			tape.get_pitched_derivatives()[i],
+			tape.get_warped_derivatives()[i]};
+	};
+	const auto draw_chunk = [&](size_t chunk) {
+		transform::Tape tape{&tables};
+		const auto beg = uint64_t(chunk) * CHUNK_SIZE;
+		const auto end = std::min(beg + CHUNK_SIZE, n.value);
+		BlockPositions block_positions;
+		for (auto index = beg; index < end; index += BLINK_VECTOR_SIZE) {
+			const auto count = int(std::min(end - index, uint64_t(BLINK_VECTOR_SIZE)));
+			add_positions(&block_positions, index, count);
+			tape.xform(config.tape, block_positions, count);
+			for (int i = 0; i < count; i++) {
+				write(index + i, get_point(tape, i));
+			}
+		}
+	};
+	// Starts with every COARSE_STRIDE'th pixel. Any span which crosses a
+	// breakpoint, or which could be further from a straight line than the
+	// tolerance, is split in half until it isn't. Whatever is left is
+	// interpolated.
+	const auto draw_chunk_interpolated = [&](size_t chunk) {
+		struct Span {
+			uint32_t a;
+			uint32_t b;
+			TapePoint pa;
+			TapePoint pb;
+		};
+		transform::Tape tape{&tables};
+		const auto beg  = uint64_t(chunk) * CHUNK_SIZE;
+		const auto size = uint32_t(std::min(beg + CHUNK_SIZE, n.value) - beg);
+		std::vector<uint32_t> pending;
+		std::vector<TapePoint> evaluated;
+		std::vector<Span> spans;
+		std::vector<Span> split_spans;
+		BlockPositions block_positions;
+		const auto evaluate_pending = [&]() {
+			std::array<blink_Position, BLINK_VECTOR_SIZE> positions;
+			evaluated.resize(pending.size());
+			for (size_t j = 0; j < pending.size(); j += BLINK_VECTOR_SIZE) {
+				const auto count = int(std::min(pending.size() - j, size_t(BLINK_VECTOR_SIZE)));
+				for (int i = 0; i < count; i++) {
+					positions[i] = get_position(beg + pending[j + i]);
+				}
+				block_positions.add(positions.data(), count);
+				tape.xform(config.tape, block_positions, count);
+				for (int i = 0; i < count; i++) {
+					evaluated[j + i] = get_point(tape, i);
+					write(beg + pending[j + i], evaluated[j + i]);
+				}
+			}
+		};
+		const auto is_close = [&](const Span& span) {
+			const auto x0 = get_position(beg + span.a);
+			const auto x1 = get_position(beg + span.b);
+			return tape.is_smooth(config.tape, x0, x1) && get_max_error(span.pa, span.pb, x1 - x0) <= config.tolerance;
+		};
+		for (uint32_t i = 0; i < size; i += COARSE_STRIDE) {
+			pending.push_back(i);
+		}
+		if (pending.back() != size - 1) {
+			pending.push_back(size - 1);
+		}
+		evaluate_pending();
+		for (size_t i = 1; i < pending.size(); i++) {
+			spans.push_back({pending[i - 1], pending[i], evaluated[i - 1], evaluated[i]});
+		}
+		while (!spans.empty()) {
+			pending.clear();
+			split_spans.clear();
+			for (const auto& span : spans) {
+				if (span.b - span.a < 2) {
+					continue;
+				}
+				if (is_close(span)) {
+					write_span(beg + span.a, beg + span.b, span.pa, span.pb);
+					continue;
+				}
+				pending.push_back(span.a + ((span.b - span.a) / 2));
+				split_spans.push_back(span);
+			}
+			evaluate_pending();
+			spans.clear();
+			for (size_t i = 0; i < split_spans.size(); i++) {
+				const auto& span = split_spans[i];
+				spans.push_back({span.a, pending[i], span.pa, evaluated[i]});
+				spans.push_back({pending[i], span.b, evaluated[i], span.pb});
+			}
+		}
+	};
+	if (interpolate) {
+		run_chunks(pool, n.value, draw_chunk_interpolated);
+	}
+	else {
+		run_chunks(pool, n.value, draw_chunk);
+	}
+	if (draw_peaks) {
+		peaks(pool, *config.peak_pyramid, out.final_sample_positions, n, out);
+	}
+}
+
+} // detail
+
+// The transform tables for [config]. Drawing again with the same config
+// can reuse them.
+[[nodiscard]] inline
+auto make_tables(const TapeConfig& config) -> transform::Tape::Tables {
+	transform::Tape::Tables tables;
+	transform::Tape::update_tables(config.tape, &tables);
+	return tables;
+}
+
+// Fills in every position, derivative and peak output in [out] that
+// isn't null. amp is left to the caller. [pool] may be null to do
+// everything on the calling thread.
+//
+// If varying.ramp covers all [n] pixels then varying.positions isn't read.
+// [tables] must have been made from the same config (see make_tables().)
+inline
+auto tape(WorkerPool* pool, const transform::Tape::Tables& tables, const TapeConfig& config, const blink_VaryingData& varying, blink_FrameCount n, blink_SamplerDrawInfo out) -> void {
+	std::vector<double> final_positions;
+	detail::tape(pool, tables, config, varying, n, out, &final_positions);
+}
+
+inline
+auto tape(WorkerPool* pool, const TapeConfig& config, const blink_VaryingData& varying, blink_FrameCount n, blink_SamplerDrawInfo out) -> void {
+	tape(pool, make_tables(config), config, varying, n, out);
+}
+
+// The same as tape() but for blink_sampler_draw_stream(). [draw_amp] is
+// called as
+//
+//	void draw_amp(const blink_VaryingData& varying, blink_FrameCount n, float* out)
+//
+// with the varying data for each chunk, if amp was asked for.
+template <typename DrawAmpFn> inline
+auto tape_stream(WorkerPool* pool, const TapeConfig& config, const blink_VaryingData& varying, blink_FrameCount n, blink_SamplerDrawStream stream, DrawAmpFn&& draw_amp) -> blink_Error {
+	if (!config.peak_pyramid) {
+		stream.outputs &= ~draw_stream::PEAK_OUTPUTS;
+	}
+	const auto channels = uint64_t(config.peak_pyramid ? config.peak_pyramid->get_num_channels() : 1);
+	// Enough for one CHUNK_SIZE per thread once the extra pixel either
+	// side is added
+	const auto default_chunk_size = (CHUNK_SIZE * uint64_t(pool ? pool->get_thread_count() + 1 : 1)) - 2;
+	// Shared by every chunk
+	const auto tables = make_tables(config);
+	std::vector<double> final_positions;
+	return draw_stream::run(stream, n, channels, default_chunk_size, [&](uint64_t beg, uint64_t count, blink_SamplerDrawInfo* out) {
+		const auto range_varying = draw_stream::offset(varying, beg);
+		detail::tape(pool, tables, config, range_varying, {count}, *out, &final_positions);
+		if (out->amp) {
+			draw_amp(range_varying, blink_FrameCount{count}, out->amp);
+		}
+		return blink_Error{BLINK_OK};
+	});
+}
+
+} // draw
+} // blink
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <blink.h>
+#include <cstdint>
+#include <vector>
+
+// Support for blink_sampler_draw_stream(), shared by plugins which
+// implement it and by hosts which emulate it with blink_sampler_draw() for
+// plugins which don't.
+//
+// The pixels are drawn a chunk at a time into buffers which are reused
+// for every chunk, so the memory used doesn't depend on the width of the
+// draw. Each chunk is drawn with an extra pixel either side so that the
+// peaks at its edges come out the same as they would in one big draw.
+
+namespace blink {
+namespace draw_stream {
+
+static constexpr auto DEFAULT_CHUNK_SIZE = uint64_t(BLINK_VECTOR_SIZE * 64);
+static constexpr auto PEAK_OUTPUTS       = uint32_t(blink_SamplerDrawOutput_PeakMin | blink_SamplerDrawOutput_PeakMax | blink_SamplerDrawOutput_PeakRMS);
+
+// In blink_SamplerDrawOutput order
+[[nodiscard]] inline
+auto get_position_outputs(blink_SamplerDrawInfo* info) -> std::array<double**, 5> {
+	return {&info->sculpted_sample_positions, &info->warped_sample_positions, &info->sculpted_block_positions, &info->warped_block_positions, &info->final_sample_positions};
+}
+
+[[nodiscard]] inline
+auto get_position_outputs(blink_SamplerDrawPositionsF32* info) -> std::array<float**, 5> {
+	return {&info->sculpted_sample_positions, &info->warped_sample_positions, &info->sculpted_block_positions, &info->warped_block_positions, &info->final_sample_positions};
+}
+
+// Everything after the positions, in blink_SamplerDrawOutput order
+[[nodiscard]] inline
+auto get_value_outputs(blink_SamplerDrawInfo* info) -> std::array<float**, 5> {
+	return {&info->waveform_derivatives, &info->amp, &info->peak_min, &info->peak_max, &info->peak_rms};
+}
+
+// The number of channels for the peaks and 1 for everything else
+[[nodiscard]] inline
+auto get_value_rows(int output, uint64_t channels) -> uint64_t {
+	return output < 2 ? 1 : channels;
+}
+
+// blink_SamplerDrawOutput flags for the arrays which aren't null
+[[nodiscard]] inline
+auto get_output_mask(blink_SamplerDrawInfo info) -> uint32_t {
+	auto mask = uint32_t(0);
+	auto bit  = 0;
+	for (auto output : get_position_outputs(&info)) {
+		mask |= (*output ? 1u : 0u) << bit++;
+	}
+	for (auto output : get_value_outputs(&info)) {
+		mask |= (*output ? 1u : 0u) << bit++;
+	}
+	return mask;
+}
+
+// The varying data for the pixels from [beg] onwards
+[[nodiscard]] inline
+auto offset(blink_VaryingData varying, uint64_t beg) -> blink_VaryingData {
+	varying.positions += beg;
+	if (varying.ramp.count > 0) {
+		varying.ramp.start += double(beg) * varying.ramp.step;
+		varying.ramp.count -= int(beg);
+	}
+	return varying;
+}
+
+// Draws [n] pixels and passes them to stream.sink. [draw] is called as
+//
+//	blink_Error draw(uint64_t beg, uint64_t count, blink_SamplerDrawInfo* out)
+//
+// to fill in the pixels [beg, beg + count) of the whole draw, as if they
+// were a draw of [count] pixels by themselves. [channels] is the number
+// of peak rows. [default_chunk_size] is used if the stream doesn't say.
+template <typename DrawFn> inline
+auto run(const blink_SamplerDrawStream& stream, blink_FrameCount n, uint64_t channels, uint64_t default_chunk_size, DrawFn&& draw) -> blink_Error {
+	const auto chunk_size  = stream.chunk_size.value > 0 ? stream.chunk_size.value : default_chunk_size;
+	const auto padded_size = chunk_size + 2;
+	const auto as_floats   = bool(stream.float_positions.value);
+	const auto wants       = [&stream](int output) { return (stream.outputs & (1u << output)) != 0; };
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> float_positions;
+	std::array<std::vector<float>, 5> values;
+	for (int i = 0; i < int(positions.size()); i++) {
+		if (!wants(i)) continue;
+		positions[i].resize(padded_size);
+		if (as_floats) float_positions[i].resize(chunk_size);
+	}
+	for (int i = 0; i < int(values.size()); i++) {
+		if (!wants(int(positions.size()) + i)) continue;
+		values[i].resize(padded_size * get_value_rows(i, channels));
+	}
+	for (uint64_t first = 0; first < n.value; first += chunk_size) {
+		const auto count = std::min(chunk_size, n.value - first);
+		// One more pixel either side, where there is one
+		const auto beg  = first > 0 ? first - 1 : first;
+		const auto end  = std::min(first + count + 1, n.value);
+		const auto lead = first - beg;
+		blink_SamplerDrawInfo info = {};
+		const auto info_positions = get_position_outputs(&info);
+		const auto info_values    = get_value_outputs(&info);
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (!positions[i].empty()) *info_positions[i] = positions[i].data();
+		}
+		for (size_t i = 0; i < values.size(); i++) {
+			if (!values[i].empty()) *info_values[i] = values[i].data();
+		}
+		if (const auto error = draw(beg, end - beg, &info); error != BLINK_OK) {
+			return error;
+		}
+		// Drop the extra pixels
+		blink_SamplerDrawChunk chunk = {};
+		chunk.first = first;
+		chunk.count = {count};
+		const auto chunk_positions       = get_position_outputs(&chunk.data);
+		const auto chunk_float_positions = get_position_outputs(&chunk.float_data);
+		const auto chunk_values          = get_value_outputs(&chunk.data);
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (positions[i].empty()) continue;
+			if (as_floats) {
+				std::transform(positions[i].begin() + lead, positions[i].begin() + lead + count, float_positions[i].begin(), [](double x) { return float(x); });
+				*chunk_float_positions[i] = float_positions[i].data();
+				continue;
+			}
+			*chunk_positions[i] = positions[i].data() + lead;
+		}
+		for (int i = 0; i < int(values.size()); i++) {
+			if (values[i].empty()) continue;
+			const auto rows = get_value_rows(i, channels);
+			if (rows == 1) {
+				*chunk_values[i] = values[i].data() + lead;
+				continue;
+			}
+			// Close up the gaps between the channels. Each one only ever
+			// moves to the left so they can be done in order.
+			for (uint64_t row = 0; row < rows; row++) {
+				const auto from = values[i].begin() + (row * (end - beg)) + lead;
+				const auto to   = values[i].begin() + (row * count);
+				if (from != to) std::copy(from, from + count, to);
+			}
+			*chunk_values[i] = values[i].data();
+		}
+		if (!stream.sink(stream.user, &chunk).value) {
+			break;
+		}
+	}
+	return BLINK_OK;
+}
+
+} // draw_stream
+} // blink
@@ -5,10 +5,15 @@
 #include <cassert>
 #include <ent.hpp>
 #include "common_impl.hpp"
+#include "compat.hpp"
+#include "draw_stream.hpp"
 #include "math.hpp"
 #include "tweak.hpp"
 #include "types.hpp"
 #include <cs_lr_guarded.h>
+#include <algorithm>
+#include <array>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
@@ -20,6 +25,7 @@ struct IsAlive { bool value = false; };
 
 using PluginTable = ent::simple_table<
 	"blink:host:plugin-table",
+	ApiVersion,
 	blink_PluginInfo,
 	PluginType,
 	PluginTypeIdx,
@@ -129,6 +135,33 @@ struct SampleAnalysis {
 	lg::lr_guarded<SampleInfoMap> sample_info;
 };
 
+// The results of the last sampler_draw() for one view of one block, so
+// that when the view is scrolled only the newly exposed pixels have to be
+// drawn. The rest are shifted across. Anything that changes the key
+// throws the whole thing away. For a given key the host must always
+// give the same block position to the same pixel.
+struct SamplerDrawCache {
+	struct Key {
+		blink_PluginIdx plugin;
+		uint64_t uniform_id;
+		blink_ID sample_id;
+		bool analysis_ready;
+		// Block positions per pixel, or whatever the host uses to scale them
+		double zoom;
+		// Which outputs were asked for, as blink_SamplerDrawOutput flags
+		uint32_t outputs;
+		auto operator==(const Key& rhs) const -> bool {
+			return plugin.value == rhs.plugin.value && uniform_id == rhs.uniform_id && sample_id.value == rhs.sample_id.value && analysis_ready == rhs.analysis_ready && zoom == rhs.zoom && outputs == rhs.outputs;
+		}
+	};
+	std::optional<Key> key;
+	int64_t first_pixel = 0;
+	uint64_t n = 0;
+	// In the same order as blink_SamplerDrawInfo
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> values;
+};
+
 struct Host {
 	PluginTable plugin;
 	PluginSamplerTable plugin_sampler;
@@ -368,6 +401,12 @@ auto process(Host* host, blink_InstanceIdx instance_idx) -> InstanceProcess& {
 	return host->instance.get<InstanceProcess>(instance_idx.value);
 }
 
+// The BLINK_API_VERSION the plugin was built against
+[[nodiscard]] inline
+auto api_version(const Host& host, blink_PluginIdx plugin_idx) -> int {
+	return host.plugin.get<ApiVersion>(plugin_idx.value).value;
+}
+
 [[nodiscard]] inline
 auto type(const Host& host, blink_PluginIdx plugin_idx) -> PluginType {
 	return host.plugin.get<PluginType>(plugin_idx.value);
@@ -380,6 +419,13 @@ auto sampler_baked_waveform_could_be_different(const Host& host, blink_PluginIdx
 	return sampler_info.value.baked_waveform_could_be_different.value;
 }
 
+[[nodiscard]] inline
+auto sampler_draws_peaks(const Host& host, blink_PluginIdx plugin_idx) -> bool {
+	const auto type_idx     = host.plugin.get<PluginTypeIdx>(plugin_idx.value).value;
+	const auto sampler_info = host.plugin_sampler.get<SamplerInfo>(type_idx);
+	return sampler_info.value.draws_peaks.value;
+}
+
 [[nodiscard]] inline
 auto sampler_requires_sample_analysis(const Host& host, blink_PluginIdx plugin_idx) -> bool {
 	const auto type_idx     = host.plugin.get<PluginTypeIdx>(plugin_idx.value).value;
@@ -608,8 +654,12 @@ auto override_env(Host* host, ParamSliderRealIdx sld_idx, OverrideEnvIdx value)
 	host->param_slider_real.set(sld_idx.value, value);
 }
 
+// Must be called before blink_init(), because this is also where the API
+// versions are exchanged
 inline
 auto plugin_interface(Host* host, blink_PluginIdx plugin_idx, PluginInterface iface) -> void {
+	const auto version = iface.exchange_api_version ? iface.exchange_api_version(BLINK_API_VERSION) : 1;
+	host->plugin.set(plugin_idx.value, ApiVersion{version});
 	host->plugin.set(plugin_idx.value, iface);
 }
 
@@ -621,7 +671,8 @@ auto name(Host* host, ParamGlobalIdx param_idx, blink_StaticString name) -> void
 inline
 auto sampler_info(Host* host, blink_PluginIdx plugin_idx, blink_SamplerInfo info) -> void {
 	const auto sub_idx = host->plugin.get<PluginTypeIdx>(plugin_idx.value).value;
-	host->plugin_sampler.set(sub_idx, SamplerInfo{info});
+	const auto version = host->plugin.get<ApiVersion>(plugin_idx.value).value;
+	host->plugin_sampler.set(sub_idx, SamplerInfo{compat::sampler_info(version, info)});
 }
 
 inline
@@ -1691,13 +1742,184 @@ auto effect_process(Host* host, blink_UnitIdx unit_idx, const blink_VaryingData&
 inline
 auto sampler_draw(const Host& host, blink_PluginIdx plugin_idx, const blink_SamplerVaryingData& varying, const blink_SamplerUniformData& uniform, blink_FrameCount n, blink_SamplerDrawInfo* out) -> blink_Error {
 	const auto& plugin = read::iface(host, plugin_idx);
-	return plugin.sampler.draw(&varying, &uniform, n, out);
+	compat::v1::SamplerVaryingData v1_varying;
+	return plugin.sampler.draw(compat::plugin_varying(read::api_version(host, plugin_idx), varying, &v1_varying), &uniform, n, out);
+}
+
+namespace detail {
+
+// Draws pixels [beg, beg + count) of [out], which is [n] pixels wide, so
+// that they come out the same as in a draw of all [n]. Like the chunks of
+// draw_stream::run(), the range is drawn with an extra pixel either side,
+// where there is one, so that the peaks at its edges can see their
+// neighbours. Everything is drawn into temporary arrays and the extra
+// pixels are dropped on the way into [out].
+inline
+auto sampler_draw_range(const Host& host, blink_PluginIdx plugin_idx, const blink_SamplerVaryingData& varying, const blink_SamplerUniformData& uniform, uint64_t channels, uint64_t beg, uint64_t count, uint64_t n, blink_SamplerDrawInfo* out) -> blink_Error {
+	const auto padded_beg   = beg > 0 ? beg - 1 : beg;
+	const auto padded_end   = std::min(beg + count + 1, n);
+	const auto padded_count = padded_end - padded_beg;
+	const auto lead         = beg - padded_beg;
+	auto range_varying = varying;
+	range_varying.base = draw_stream::offset(varying.base, padded_beg);
+	blink_SamplerDrawInfo range_out = {};
+	const auto out_positions   = draw_stream::get_position_outputs(out);
+	const auto out_values      = draw_stream::get_value_outputs(out);
+	const auto range_positions = draw_stream::get_position_outputs(&range_out);
+	const auto range_values    = draw_stream::get_value_outputs(&range_out);
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> values;
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (!*out_positions[i]) continue;
+		positions[i].resize(padded_count);
+		*range_positions[i] = positions[i].data();
+	}
+	for (int i = 0; i < int(values.size()); i++) {
+		if (!*out_values[i]) continue;
+		values[i].resize(padded_count * draw_stream::get_value_rows(i, channels));
+		*range_values[i] = values[i].data();
+	}
+	if (const auto error = sampler_draw(host, plugin_idx, range_varying, uniform, {padded_count}, &range_out); error != BLINK_OK) {
+		return error;
+	}
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (positions[i].empty()) continue;
+		std::copy(positions[i].begin() + lead, positions[i].begin() + lead + count, *out_positions[i] + beg);
+	}
+	for (int i = 0; i < int(values.size()); i++) {
+		if (values[i].empty()) continue;
+		for (uint64_t row = 0; row < draw_stream::get_value_rows(i, channels); row++) {
+			const auto from = values[i].begin() + (row * padded_count) + lead;
+			std::copy(from, from + count, *out_values[i] + (row * n) + beg);
+		}
+	}
+	return BLINK_OK;
+}
+
+} // detail
+
+// Draws [n] pixels starting from [first_pixel], reusing whatever is in
+// [cache] from the last call and then updating it. Only the pixels which
+// weren't drawn last time are passed to the plugin.
+inline
+auto sampler_draw(const Host& host, SamplerDrawCache* cache, blink_PluginIdx plugin_idx, const blink_SamplerVaryingData& varying, const blink_SamplerUniformData& uniform, double zoom, int64_t first_pixel, blink_FrameCount n, blink_SamplerDrawInfo* out) -> blink_Error {
+	const auto channels = uint64_t(varying.sample_info ? varying.sample_info->num_channels.value : 1);
+	const SamplerDrawCache::Key key{plugin_idx, uniform.base.id, varying.sample_info ? varying.sample_info->id : blink_ID{0}, bool(varying.analysis_ready.value), zoom, draw_stream::get_output_mask(*out)};
+	if (!cache->key || !(*cache->key == key)) {
+		cache->key.reset();
+		cache->n = 0;
+	}
+	// A pixel at the edge of a draw has no neighbour on one side, and is
+	// drawn differently from one which has. So unless an edge hasn't
+	// moved, the pixel either side of it can't be reused.
+	const auto last_pixel = first_pixel + int64_t(n.value);
+	const auto cache_end  = cache->first_pixel + int64_t(cache->n);
+	const auto beg        = first_pixel == cache->first_pixel ? first_pixel : std::max(first_pixel, cache->first_pixel) + 1;
+	const auto end        = last_pixel == cache_end ? last_pixel : std::min(last_pixel, cache_end) - 1;
+	auto error            = blink_Error{BLINK_OK};
+	if (end <= beg) {
+		error = sampler_draw(host, plugin_idx, varying, uniform, n, out);
+	}
+	else {
+		// Shift across the pixels we already have
+		const auto from  = uint64_t(beg - cache->first_pixel);
+		const auto to    = uint64_t(beg - first_pixel);
+		const auto count = uint64_t(end - beg);
+		const auto position_outputs = draw_stream::get_position_outputs(out);
+		for (size_t i = 0; i < position_outputs.size(); i++) {
+			if (!*position_outputs[i]) continue;
+			std::copy(cache->positions[i].begin() + from, cache->positions[i].begin() + from + count, *position_outputs[i] + to);
+		}
+		const auto value_outputs = draw_stream::get_value_outputs(out);
+		for (int i = 0; i < int(value_outputs.size()); i++) {
+			if (!*value_outputs[i]) continue;
+			for (uint64_t row = 0; row < draw_stream::get_value_rows(i, channels); row++) {
+				const auto cached = cache->values[i].begin() + (row * cache->n) + from;
+				std::copy(cached, cached + count, *value_outputs[i] + (row * n.value) + to);
+			}
+		}
+		// Draw whatever is newly exposed on either side
+		if (to > 0) {
+			error = detail::sampler_draw_range(host, plugin_idx, varying, uniform, channels, 0, to, n.value, out);
+		}
+		if (error == BLINK_OK && to + count < n.value) {
+			error = detail::sampler_draw_range(host, plugin_idx, varying, uniform, channels, to + count, n.value - (to + count), n.value, out);
+		}
+	}
+	if (error != BLINK_OK) {
+		cache->key.reset();
+		cache->n = 0;
+		return error;
+	}
+	cache->key         = key;
+	cache->first_pixel = first_pixel;
+	cache->n           = n.value;
+	const auto position_outputs = draw_stream::get_position_outputs(out);
+	for (size_t i = 0; i < position_outputs.size(); i++) {
+		if (!*position_outputs[i]) continue;
+		cache->positions[i].assign(*position_outputs[i], *position_outputs[i] + n.value);
+	}
+	const auto value_outputs = draw_stream::get_value_outputs(out);
+	for (int i = 0; i < int(value_outputs.size()); i++) {
+		if (!*value_outputs[i]) continue;
+		cache->values[i].assign(*value_outputs[i], *value_outputs[i] + (draw_stream::get_value_rows(i, channels) * n.value));
+	}
+	return BLINK_OK;
+}
+
+// Draws [n] pixels a chunk at a time, passing each one to stream.sink.
+// If the plugin doesn't implement blink_sampler_draw_stream() then each
+// chunk is drawn with blink_sampler_draw() instead. The peaks are left
+// out unless the plugin draws them.
+inline
+auto sampler_draw_stream(const Host& host, blink_PluginIdx plugin_idx, const blink_SamplerVaryingData& varying, const blink_SamplerUniformData& uniform, blink_FrameCount n, blink_SamplerDrawStream stream) -> blink_Error {
+	const auto& plugin = read::iface(host, plugin_idx);
+	if (!read::sampler_draws_peaks(host, plugin_idx)) {
+		stream.outputs &= ~draw_stream::PEAK_OUTPUTS;
+	}
+	if (plugin.sampler.draw_stream) {
+		return plugin.sampler.draw_stream(&varying, &uniform, n, &stream);
+	}
+	const auto channels = uint64_t(varying.sample_info ? varying.sample_info->num_channels.value : 1);
+	return draw_stream::run(stream, n, channels, draw_stream::DEFAULT_CHUNK_SIZE, [&](uint64_t beg, uint64_t count, blink_SamplerDrawInfo* out) {
+		auto range_varying = varying;
+		range_varying.base = draw_stream::offset(varying.base, beg);
+		return sampler_draw(host, plugin_idx, range_varying, uniform, {count}, out);
+	});
+}
+
+// Returns nothing if the plugin doesn't implement it
+[[nodiscard]] inline
+auto sampler_get_sonic_fragment_at_block_position(const Host& host, blink_PluginIdx plugin_idx, const blink_SampleInfo& sample_info, const blink_SamplerUniformData& uniform, blink_Position block_position) -> std::optional<double> {
+	const auto& plugin = read::iface(host, plugin_idx);
+	if (!plugin.sampler.get_sonic_fragment_at_block_position) {
+		return std::nullopt;
+	}
+	return plugin.sampler.get_sonic_fragment_at_block_position(&sample_info, &uniform, block_position);
+}
+
+// Returns nothing if the plugin doesn't implement it or the sample
+// position is never reached
+[[nodiscard]] inline
+auto sampler_block_position_for_sonic_fragment(const Host& host, blink_PluginIdx plugin_idx, const blink_SampleInfo& sample_info, const blink_SamplerUniformData& uniform, double fragment) -> std::optional<blink_Position> {
+	const auto& plugin = read::iface(host, plugin_idx);
+	if (!plugin.sampler.block_position_for_sonic_fragment) {
+		return std::nullopt;
+	}
+	blink_Position out;
+	if (!plugin.sampler.block_position_for_sonic_fragment(&sample_info, &uniform, fragment, &out).value) {
+		return std::nullopt;
+	}
+	return out;
 }
 
 inline
 auto sampler_process(Host* host, blink_UnitIdx unit_idx, const blink_SamplerVaryingData& varying, const blink_SamplerUniformData& uniform, float* out) -> blink_Error {
-	auto process_fn = [&varying, &uniform, out](const PluginInterface& plugin_iface, blink::LocalUnitIdx local_idx) -> blink_Error {
-		return plugin_iface.sampler.process(local_idx.value, &varying, &uniform, out);
+	const auto plugin_idx = host->unit.get<UnitProcess>(unit_idx.value).plugin_idx.value;
+	compat::v1::SamplerVaryingData v1_varying;
+	const auto plugin_varying = compat::plugin_varying(read::api_version(*host, plugin_idx), varying, &v1_varying);
+	auto process_fn = [plugin_varying, &uniform, out](const PluginInterface& plugin_iface, blink::LocalUnitIdx local_idx) -> blink_Error {
+		return plugin_iface.sampler.process(local_idx.value, plugin_varying, &uniform, out);
 	};
 	return unit_process(host, unit_idx, varying.base, std::move(process_fn));
 }
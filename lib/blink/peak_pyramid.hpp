@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <blink.h>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Min, max and sum of squares of a sample over blocks of frames, at
+// successively coarser resolutions. Level 0 summarizes every BLOCK_FRAMES
+// frames and each level above it combines pairs of blocks from the one
+// below, so the peaks over any range of frames come from O(log n) blocks.
+// Ranges are rounded out to whole level 0 blocks.
+//
+// Intended to be built by a sampler plugin during
+// blink_sampler_analyze_sample() and used for drawing (see
+// draw::peaks().)
+
+namespace blink {
+
+class PeakPyramid {
+public:
+	static constexpr auto BLOCK_FRAMES = 16;
+	struct Peak {
+		float min = 0.0f;
+		float max = 0.0f;
+		float rms = 0.0f;
+	};
+	[[nodiscard]] auto build(void* host, blink_AnalysisCallbacks callbacks, const blink_SampleInfo& info) -> blink_AnalysisResult;
+	[[nodiscard]] auto get_id() const -> blink_ID { return id_; }
+	[[nodiscard]] auto get_num_channels() const -> int { return int(channels_.size()); }
+	[[nodiscard]] auto get_num_frames() const -> uint64_t { return num_frames_; }
+	// Over the frames [beg, end). Anything outside the sample is ignored.
+	[[nodiscard]] auto get(blink_ChannelCount channel, int64_t beg, int64_t end) const -> Peak;
+private:
+	static constexpr auto READ_CHUNK = 4096;
+	struct Block {
+		float min;
+		float max;
+		float sum_sq;
+	};
+	using Level = std::vector<Block>;
+	using Channel = std::vector<Level>;
+	[[nodiscard]] static auto merge(const Block& a, const Block& b) -> Block;
+	static auto read_level_0(const blink_SampleInfo& info, blink_ChannelCount channel, Level* out) -> void;
+	blink_ID id_ = {0};
+	uint64_t num_frames_ = 0;
+	std::vector<Channel> channels_;
+};
+
+inline auto PeakPyramid::merge(const Block& a, const Block& b) -> Block {
+	return {std::min(a.min, b.min), std::max(a.max, b.max), a.sum_sq + b.sum_sq};
+}
+
+inline auto PeakPyramid::read_level_0(const blink_SampleInfo& info, blink_ChannelCount channel, Level* out) -> void {
+	const auto num_frames = info.num_frames.value;
+	out->resize((num_frames + BLOCK_FRAMES - 1) / BLOCK_FRAMES);
+	std::vector<float> buffer(READ_CHUNK);
+	for (uint64_t i = 0; i < num_frames; i += READ_CHUNK) {
+		const auto size = std::min(uint64_t(READ_CHUNK), num_frames - i);
+		const float* frames;
+		if (info.channel_data) {
+			frames = info.channel_data[channel.value] + i;
+		}
+		else {
+			// Anything the host can't give us yet is left as silence
+			std::fill(buffer.begin(), buffer.end(), 0.0f);
+			info.get_data(info.host, channel, {i}, {size}, buffer.data());
+			frames = buffer.data();
+		}
+		// READ_CHUNK is a multiple of BLOCK_FRAMES so blocks don't straddle chunks
+		for (uint64_t j = 0; j < size; j += BLOCK_FRAMES) {
+			const auto count = std::min(uint64_t(BLOCK_FRAMES), size - j);
+			Block block{frames[j], frames[j], 0.0f};
+			for (uint64_t k = 0; k < count; k++) {
+				const auto x = frames[j + k];
+				block.min     = std::min(block.min, x);
+				block.max     = std::max(block.max, x);
+				block.sum_sq += x * x;
+			}
+			(*out)[(i + j) / BLOCK_FRAMES] = block;
+		}
+	}
+}
+
+inline auto PeakPyramid::build(void* host, blink_AnalysisCallbacks callbacks, const blink_SampleInfo& info) -> blink_AnalysisResult {
+	id_         = info.id;
+	num_frames_ = info.num_frames.value;
+	channels_.clear();
+	channels_.resize(info.num_channels.value);
+	for (uint8_t c = 0; c < info.num_channels.value; c++) {
+		if (callbacks.should_abort && callbacks.should_abort(host)) {
+			channels_.clear();
+			return blink_AnalysisResult_Abort;
+		}
+		auto& levels = channels_[c];
+		levels.emplace_back();
+		read_level_0(info, {c}, &levels.back());
+		while (levels.back().size() > 1) {
+			const auto& below = levels.back();
+			Level level((below.size() + 1) / 2);
+			for (size_t i = 0; i < level.size(); i++) {
+				const auto a = 2 * i;
+				level[i] = a + 1 < below.size() ? merge(below[a], below[a + 1]) : below[a];
+			}
+			levels.push_back(std::move(level));
+		}
+		if (callbacks.report_progress) {
+			callbacks.report_progress(host, float(c + 1) / float(info.num_channels.value));
+		}
+	}
+	return blink_AnalysisResult_OK;
+}
+
+inline auto PeakPyramid::get(blink_ChannelCount channel, int64_t beg, int64_t end) const -> Peak {
+	beg = std::max(beg, int64_t(0));
+	end = std::min(end, int64_t(num_frames_));
+	if (channel.value >= channels_.size() || beg >= end) {
+		return {};
+	}
+	const auto& levels = channels_[channel.value];
+	// Whole level 0 blocks
+	auto b = size_t(beg / BLOCK_FRAMES);
+	auto e = size_t((end + BLOCK_FRAMES - 1) / BLOCK_FRAMES);
+	const auto frames = std::min(e * BLOCK_FRAMES, size_t(num_frames_)) - (b * BLOCK_FRAMES);
+	Block block{std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), 0.0f};
+	// Climb the levels, taking the odd blocks off either end each time
+	for (size_t level = 0; b < e; level++, b /= 2, e /= 2) {
+		const auto& blocks = levels[level];
+		if (b & 1) {
+			block = merge(block, blocks[b++]);
+		}
+		if (e & 1) {
+			block = merge(block, blocks[--e]);
+		}
+	}
+	Peak out;
+	out.min = block.min;
+	out.max = block.max;
+	out.rms = std::sqrt(block.sum_sq / float(frames));
+	return out;
+}
+
+} // blink
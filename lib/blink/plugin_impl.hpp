@@ -4,6 +4,7 @@
 #include "blink.h"
 #include "block_positions.hpp"
 #include "common_impl.hpp"
+#include "compat.hpp"
 #include "data.hpp"
 #include "resource_store.hpp"
 #include "types.hpp"
@@ -34,6 +35,9 @@ struct Plugin {
 	blink_PluginIdx index;
 	blink_HostFns host;
 	ResourceStore resource_store;
+	// The blink.h version the host was built against. Stays 1 if the
+	// host never calls blink_exchange_api_version().
+	int host_api_version = 1;
 };
 
 template <typename Instance, typename Unit>
@@ -42,6 +46,13 @@ struct Entities {
 	Unit unit;
 };
 
+// For the plugin's blink_exchange_api_version()
+inline
+auto exchange_api_version(Plugin* plugin, int host_version) -> int {
+	plugin->host_api_version = host_version;
+	return BLINK_API_VERSION;
+}
+
 inline
 auto init(Plugin* plugin, blink_PluginIdx plugin_index, blink_HostFns host_fns) -> void {
 	plugin->index = plugin_index;
@@ -84,6 +95,44 @@ auto destroy_instance(Entities<Instance, Unit>* ents, blink_InstanceIdx instance
 	return BLINK_OK;
 }
 
+// Each exported entry point which is passed structs by the host calls
+// [fn] through one of these, which converts anything from an older host
+// to the current layouts first. [fn] mustn't keep the pointers.
+namespace entry {
+
+template <typename Fn> [[nodiscard]]
+auto effect_process(const Plugin& plugin, const blink_VaryingData* varying, Fn&& fn) -> blink_Error {
+	blink_VaryingData buffer;
+	return fn(compat::varying(plugin.host_api_version, varying, &buffer));
+}
+
+template <typename Fn> [[nodiscard]]
+auto synth_process(const Plugin& plugin, const blink_VaryingData* varying, Fn&& fn) -> blink_Error {
+	blink_VaryingData buffer;
+	return fn(compat::varying(plugin.host_api_version, varying, &buffer));
+}
+
+template <typename Fn> [[nodiscard]]
+auto sampler_process(const Plugin& plugin, const blink_SamplerVaryingData* varying, Fn&& fn) -> blink_Error {
+	compat::SamplerVaryingData buffer;
+	return fn(compat::varying(plugin.host_api_version, varying, &buffer));
+}
+
+template <typename Fn> [[nodiscard]]
+auto sampler_draw(const Plugin& plugin, const blink_SamplerVaryingData* varying, blink_SamplerDrawInfo* out, Fn&& fn) -> blink_Error {
+	compat::SamplerVaryingData varying_buffer;
+	blink_SamplerDrawInfo out_buffer;
+	return fn(compat::varying(plugin.host_api_version, varying, &varying_buffer), compat::draw_info(plugin.host_api_version, out, &out_buffer));
+}
+
+template <typename Fn> [[nodiscard]]
+auto sampler_analyze_sample(const Plugin& plugin, const blink_SampleInfo* sample_info, Fn&& fn) -> blink_AnalysisResult {
+	blink_SampleInfo buffer;
+	return fn(compat::sample_info(plugin.host_api_version, sample_info, &buffer));
+}
+
+} // entry
+
 [[nodiscard]] inline
 auto get_std_error_string(blink_StdError error) -> const char* {
 	switch (error) {
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cmath>
+#include <limits>
+#include <numeric>
 #include <blink/math.hpp>
+#include <blink/sample_pyramid.hpp>
+#include <blink/simd.hpp>
 #include <snd/frame-pos.hpp>
 
 namespace blink {
@@ -10,8 +17,15 @@ class SampleData
 {
 public:
 
+	enum class InterpMode
+	{
+		linear,
+		cubic, // 4-point Hermite
+		sinc,  // 8-point polyphase windowed sinc
+	};
+
 	SampleData() = default;
-	SampleData(const blink_SampleInfo* info, blink_ChannelMode channel_mode);
+	SampleData(const blink_SampleInfo* info, blink_ChannelMode channel_mode, InterpMode interp_mode = InterpMode::linear);
 
 	blink_SR get_SR() const { return info_->SR; }
 	blink_FrameCount get_num_frames() const { return info_->num_frames; }
@@ -27,15 +41,95 @@ public:
 	template <std::size_t ROWS>
 	ml::DSPVectorArray<ROWS> read_frames_interp(const snd::frame_vec<64>& pos, bool loop) const;
 
+	// The pyramid level read from for this vector and the last one. Should
+	// be kept between vectors by whoever is doing the reading, e.g. one
+	// per voice, and updated once per vector.
+	struct PyramidLevel
+	{
+		int prev = 0;
+		int level = 0;
+	};
+
+	// [derivatives] is the rate each lane is moving through the sample,
+	// e.g. Tape::get_pitched_derivatives(). If a pyramid has been set and
+	// the rate is 2x or more, frames are read from a decimated level of it
+	// instead of the sample itself.
+	void update_pyramid_level(const ml::DSPVector& derivatives, PyramidLevel* level) const;
+
+	// When the level has changed since the last vector, the two levels are
+	// crossfaded over this one.
+	ml::DSPVector read_frames_interp(blink_ChannelCount channel, const snd::frame_vec<64>& pos, bool loop, PyramidLevel level) const;
+
+	template <std::size_t ROWS>
+	ml::DSPVectorArray<ROWS> read_frames_interp(const snd::frame_vec<64>& pos, bool loop, PyramidLevel level) const;
+
+	// If the host streams the sample, asks for the frames the next [vectors]
+	// vectors are likely to read to be made resident. The prediction is a
+	// linear extrapolation from the current positions at the given rates,
+	// e.g. Tape::get_pitched_derivatives(). Doesn't block.
+	void read_ahead(const snd::frame_vec<64>& pos, const ml::DSPVector& derivatives, bool loop, int vectors = 4) const;
+
 	blink_ChannelMode get_channel_mode() const { return channel_mode_; }
+	InterpMode get_interp_mode() const { return interp_mode_; }
+	void set_interp_mode(InterpMode mode) { interp_mode_ = mode; }
+	// The pyramid must have been built from the same sample, and outlive
+	// this object. Null to stop using it.
+	void set_pyramid(const SamplePyramid* pyramid) { pyramid_ = pyramid; }
 
 private:
 
+	// Frames touched by a vector are fetched from the host in contiguous
+	// spans and gathered from this buffer. The lanes are split into
+	// clusters which each fit in a span, so a vector which wraps round a
+	// loop or touches a wider range than this (e.g. extreme pitch) takes
+	// a few spans rather than one for the whole range. None of this
+	// applies if the host gave us direct access to the sample data.
+	static constexpr auto MAX_SPAN = 4096;
+
+	// Deliberately a local in each function which reads through it, not a
+	// member. The reads are const and can be made from several threads at
+	// once, and a SampleData is only a few pointers so it's cheap to make
+	// one per call, which a member buffer would turn into an allocation.
+	// The functions which have one don't call each other, so there is only
+	// ever one on the stack, and it's left uninitialized so it costs
+	// nothing but the stack space.
+	using StagingBuffer = std::array<float, MAX_SPAN>;
+
+	// A cluster is also split where there's a gap between lanes of more
+	// than this many frames, which would cost more to copy than another
+	// callback
+	static constexpr auto MAX_GAP = 64;
+
+	// Frames per call when fetching native integer data
+	static constexpr auto RAW_CHUNK = 1024;
+
+	struct Span
+	{
+		int beg;
+		int end;
+
+		int size() const { return end - beg; }
+	};
+
+	// Lanes whose frames fit in a single span
+	struct Cluster
+	{
+		Span span;
+		std::bitset<kFloatsPerDSPVector> lanes;
+	};
+
+	struct Clusters
+	{
+		std::array<Cluster, kFloatsPerDSPVector> clusters;
+		int count = 0;
+	};
+
 	struct InterpPos
 	{
 		int prev;
 		int next;
 		float x;
+		bool loop = false;
 	};
 
 	struct InterpVectorPos
@@ -43,34 +137,158 @@ private:
 		ml::DSPVectorInt prev;
 		ml::DSPVectorInt next;
 		ml::DSPVector x;
+		// Some lane's interpolation taps cross the loop seam
+		bool seam = false;
+	};
+
+	// When looping, interpolation taps past the end of the loop read from
+	// the start of it and vice versa. Taps that cross the seam are read
+	// from a buffer of the frames either side of it, built when a vector
+	// actually needs it.
+	static constexpr auto SEAM_FRAMES = simd::SINC_TAPS / 2;
+
+	struct LoopRange
+	{
+		int beg;
+		int end;
+	};
+
+	struct SeamBuffer
+	{
+		// [loop end - SEAM_FRAMES, loop end) followed by
+		// [loop beg, loop beg + SEAM_FRAMES)
+		std::array<float, SEAM_FRAMES * 2> frames;
+	};
+
+	// Positions of the form first + (i * step) where first and step are
+	// both integers, e.g. unmodified playback
+	struct Stride
+	{
+		int first;
+		int step;
 	};
 
 	InterpPos get_interp_pos(float pos, bool loop = false) const;
-	InterpVectorPos get_interp_pos(snd::frame_vec<64> pos, bool loop) const;
+	// [pos] must already have been through get_loop_pos() if [loop] is set
+	InterpVectorPos get_wrapped_interp_pos(const snd::frame_vec<64>& pos, bool loop) const;
+	bool get_stride(const snd::frame_vec<64>& pos, Stride* out) const;
+	LoopRange get_loop_range() const;
+	void get_tap_extent(int* lo, int* hi) const;
+	SeamBuffer make_seam_buffer(blink_ChannelCount channel) const;
+	float read_tap(blink_ChannelCount channel, int pos, bool loop) const;
+	void patch_seam(blink_ChannelCount channel, const InterpVectorPos& pos, ml::DSPVector* out) const;
+	float interp_one(const float* y, float x) const;
+
+	Clusters get_clusters(blink_ChannelCount channel, const ml::DSPVectorInt& min, const ml::DSPVectorInt& max, int lo = 0, int hi = 0) const;
+	static void merge(const Cluster& cluster, const float* in, float* out);
+	const float* get_direct(blink_ChannelCount channel) const;
+	bool has_raw() const;
+	blink_FrameCount get_data_raw(blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) const;
+	const float* fetch_span(blink_ChannelCount channel, Span span, float* buffer) const;
+	ml::DSPVector read_frames_stride(blink_ChannelCount channel, Stride stride) const;
+	void gather_taps(blink_ChannelCount channel, const ml::DSPVectorInt& index, int first, int count, float* taps) const;
+	ml::DSPVector read_frames_interp(blink_ChannelCount channel, const InterpVectorPos& pos) const;
+	ml::DSPVector read_frames_kernel(blink_ChannelCount channel, const InterpVectorPos& pos) const;
+	ml::DSPVector read_frames_linear(blink_ChannelCount channel, const InterpVectorPos& pos) const;
+	// Once the rate has gone up to a level, it has to come down this far
+	// below it to go back down again
+	static constexpr auto LEVEL_HYSTERESIS = 0.85f;
+
+	int get_pyramid_level(const ml::DSPVector& derivatives, int current) const;
+	ml::DSPVector read_level(int level, blink_ChannelCount channel, const snd::frame_vec<64>& pos, bool loop) const;
+	template <std::size_t ROWS>
+	ml::DSPVectorArray<ROWS> read_level(int level, const snd::frame_vec<64>& pos, bool loop) const;
+	static void crossfade(const ml::DSPVector& from, ml::DSPVector* to);
+	InterpVectorPos get_level_interp_pos(int level, snd::frame_vec<64> pos, bool loop) const;
+	ml::DSPVector read_level_interp(int level, blink_ChannelCount channel, const InterpVectorPos& pos) const;
+	ml::DSPVector read_level_kernel(int level, blink_ChannelCount channel, const InterpVectorPos& pos) const;
+	void patch_level_seam(int level, blink_ChannelCount channel, const InterpVectorPos& pos, ml::DSPVector* out) const;
 
 	const blink_SampleInfo* info_;
 	blink_FrameCount loop_length_;
 	blink_ChannelMode channel_mode_;
+	InterpMode interp_mode_ = InterpMode::linear;
+	const SamplePyramid* pyramid_ = nullptr;
 };
 
-inline SampleData::SampleData(const blink_SampleInfo* info, blink_ChannelMode channel_mode)
+inline SampleData::SampleData(const blink_SampleInfo* info, blink_ChannelMode channel_mode, InterpMode interp_mode)
 	: info_{info}
 	, loop_length_{info->loop_points ? info->loop_points[1].value - info->loop_points[0].value : 0}
 	, channel_mode_{channel_mode}
+	, interp_mode_{interp_mode}
 {
 }
 
+inline const float* SampleData::get_direct(blink_ChannelCount channel) const
+{
+	return info_->channel_data ? info_->channel_data[channel.value] : nullptr;
+}
+
 inline blink_FrameCount SampleData::get_data(blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) const
 {
+	if (const auto direct = get_direct(channel))
+	{
+		if (index.value >= info_->num_frames.value) return {0};
+
+		const auto count { std::min(size.value, info_->num_frames.value - index.value) };
+
+		std::copy(direct + index.value, direct + index.value + count, buffer);
+
+		return {count};
+	}
+
+	if (has_raw()) return get_data_raw(channel, index, size, buffer);
+
 	return info_->get_data(info_->host, channel, index, size, buffer);
 }
 
+inline bool SampleData::has_raw() const
+{
+	return info_->get_data_raw && (info_->bit_depth.value == 16 || info_->bit_depth.value == 24);
+}
+
+// Fetches native integer frames from the host in chunks and converts them
+// to float
+inline blink_FrameCount SampleData::get_data_raw(blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) const
+{
+	const auto bytes_per_frame { info_->bit_depth.value / 8 };
+
+	alignas(32) std::array<uint8_t, RAW_CHUNK * 3> raw;
+
+	uint64_t total { 0 };
+
+	while (total < size.value)
+	{
+		const auto chunk { std::min(size.value - total, uint64_t(RAW_CHUNK)) };
+		const auto fetched { std::min(info_->get_data_raw(info_->host, channel, {index.value + total}, {chunk}, raw.data()).value, chunk) };
+
+		if (bytes_per_frame == 2)
+		{
+			simd::int16_to_float(reinterpret_cast<const int16_t*>(raw.data()), int(fetched), buffer + total);
+		}
+		else
+		{
+			simd::int24_to_float(raw.data(), int(fetched), buffer + total);
+		}
+
+		total += fetched;
+
+		if (fetched < chunk) break;
+	}
+
+	return {total};
+}
+
 inline float SampleData::read_frame(blink_ChannelCount channel, int pos) const
 {
 	if (pos < 0 || pos >= int(info_->num_frames.value))
 	{
 		return 0.0f;
 	}
+	else if (const auto direct = get_direct(channel))
+	{
+		return direct[pos];
+	}
 	else
 	{
 		float out;
@@ -82,21 +300,111 @@ inline float SampleData::read_frame(blink_ChannelCount channel, int pos) const
 	}
 }
 
-inline ml::DSPVector SampleData::read_frames(blink_ChannelCount channel, const ml::DSPVectorInt& pos) const
+// [lo] and [hi] extend each lane's frames to cover interpolation taps
+// either side. Lanes are taken in order of position and a new cluster is
+// started whenever the next one wouldn't fit in the current span, or is
+// too far from it. Lanes which are entirely outside the sample aren't in
+// any cluster.
+inline auto SampleData::get_clusters(blink_ChannelCount channel, const ml::DSPVectorInt& min, const ml::DSPVectorInt& max, int lo, int hi) const -> Clusters
 {
-	ml::DSPVector out;
+	const auto direct { get_direct(channel) != nullptr };
+	const auto max_size { direct ? std::numeric_limits<int>::max() : MAX_SPAN };
+	const auto max_gap { direct ? std::numeric_limits<int>::max() : MAX_GAP };
 
-	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	std::array<int, kFloatsPerDSPVector> order;
+
+	std::iota(order.begin(), order.end(), 0);
+
+	const auto by_position = [&min](int a, int b) { return min[a] < min[b]; };
+
+	if (!std::is_sorted(order.begin(), order.end(), by_position))
+	{
+		std::sort(order.begin(), order.end(), by_position);
+	}
+
+	Clusters out;
+
+	for (const auto i : order)
 	{
-		if (pos[i] < 0 || pos[i] >= int(info_->num_frames.value))
+		const Span lane { std::max(min[i] - lo, 0), std::min(max[i] + hi + 1, int(info_->num_frames.value)) };
+
+		if (lane.size() <= 0) continue;
+
+		if (out.count > 0)
 		{
-			out[i] = 0.0f;
+			auto& cluster { out.clusters[out.count - 1] };
+
+			const auto end { std::max(cluster.span.end, lane.end) };
+
+			if (end - cluster.span.beg <= max_size && lane.beg - cluster.span.end <= max_gap)
+			{
+				cluster.span.end = end;
+				cluster.lanes.set(i);
+				continue;
+			}
 		}
-		else
+
+		auto& cluster { out.clusters[out.count++] };
+
+		cluster.span = lane;
+		cluster.lanes.reset();
+		cluster.lanes.set(i);
+	}
+
+	return out;
+}
+
+// out[i] = in[i] for the lanes in the cluster
+inline void SampleData::merge(const Cluster& cluster, const float* in, float* out)
+{
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		if (cluster.lanes[i]) out[i] = in[i];
+	}
+}
+
+// Returns a pointer to the first frame of the span. This is either
+// directly into the host's sample data or into the staging buffer.
+inline const float* SampleData::fetch_span(blink_ChannelCount channel, Span span, float* buffer) const
+{
+	if (const auto direct = get_direct(channel))
+	{
+		return direct + span.beg;
+	}
+
+	// Could return fewer frames than requested (or zero) if the sample
+	// isn't fully loaded yet. Anything missing is read as silence.
+	const auto fetched { int(get_data(channel, {uint64_t(span.beg)}, {uint64_t(span.size())}, buffer).value) };
+
+	std::fill(buffer + std::clamp(fetched, 0, span.size()), buffer + span.size(), 0.0f);
+
+	return buffer;
+}
+
+// Usually there is a single cluster and the frames are gathered straight
+// into the output
+inline ml::DSPVector SampleData::read_frames(blink_ChannelCount channel, const ml::DSPVectorInt& pos) const
+{
+	const auto clusters { get_clusters(channel, pos, pos) };
+
+	StagingBuffer staging;
+	ml::DSPVector out(0.0f);
+
+	for (int c = 0; c < clusters.count; c++)
+	{
+		const auto& cluster { clusters.clusters[c] };
+		const auto frames { fetch_span(channel, cluster.span, staging.data()) };
+
+		if (clusters.count == 1)
 		{
-			// Could return zero if sample header wasn't loaded yet.
-			if (get_data(channel, {uint64_t(pos[i])}, {1}, &(out[i])).value == 0) break;
+			simd::gather(frames, cluster.span.beg, cluster.span.size(), pos.getConstBuffer(), out.getBuffer());
+			break;
 		}
+
+		ml::DSPVector part;
+
+		simd::gather(frames, cluster.span.beg, cluster.span.size(), pos.getConstBuffer(), part.getBuffer());
+		merge(cluster, part.getConstBuffer(), out.getBuffer());
 	}
 
 	return out;
@@ -113,13 +421,141 @@ inline float SampleData::get_loop_pos(float pos) const
 }
 
 inline snd::frame_vec<64> SampleData::get_loop_pos(const snd::frame_vec<64>& pos) const
+{
+	const auto range { get_loop_range() };
+
+	alignas(32) std::array<double, kFloatsPerDSPVector> positions;
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		positions[i] = pos[i];
+	}
+
+	simd::wrap(positions.data(), double(range.beg), double(range.end - range.beg), positions.data());
+
+	snd::frame_vec<64> out;
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		out[i] = positions[i];
+	}
+
+	return out;
+}
+
+inline auto SampleData::get_loop_range() const -> LoopRange
 {
 	if (!info_->loop_points)
 	{
-		return math::wrap(pos, float(info_->num_frames.value));
+		return { 0, int(info_->num_frames.value) };
+	}
+
+	return { int(info_->loop_points[0].value), int(info_->loop_points[1].value) };
+}
+
+// How many frames before and after the previous frame the current
+// interpolation mode reads
+inline void SampleData::get_tap_extent(int* lo, int* hi) const
+{
+	switch (interp_mode_)
+	{
+		case InterpMode::cubic: *lo = 1; *hi = 2; return;
+		case InterpMode::sinc: *lo = simd::SINC_TAPS / 2 - 1; *hi = simd::SINC_TAPS / 2; return;
+		default: *lo = 0; *hi = 1; return;
+	}
+}
+
+inline auto SampleData::make_seam_buffer(blink_ChannelCount channel) const -> SeamBuffer
+{
+	const auto range { get_loop_range() };
+
+	SeamBuffer out;
+
+	for (int i = 0; i < SEAM_FRAMES; i++)
+	{
+		out.frames[i] = read_frame(channel, range.end - SEAM_FRAMES + i);
+		out.frames[SEAM_FRAMES + i] = read_frame(channel, range.beg + i);
+	}
+
+	return out;
+}
+
+inline float SampleData::read_tap(blink_ChannelCount channel, int pos, bool loop) const
+{
+	if (loop)
+	{
+		const auto range { get_loop_range() };
+
+		if (pos >= range.end) pos -= range.end - range.beg;
+		else if (pos < range.beg) pos += range.end - range.beg;
+	}
+
+	return read_frame(channel, pos);
+}
+
+// Recalculates the lanes whose taps cross the loop seam
+inline void SampleData::patch_seam(blink_ChannelCount channel, const InterpVectorPos& pos, ml::DSPVector* out) const
+{
+	const auto range { get_loop_range() };
+	const auto use_buffer { range.end - range.beg >= SEAM_FRAMES * 2 };
+	const auto seam { use_buffer ? make_seam_buffer(channel) : SeamBuffer{} };
+
+	int lo, hi;
+
+	get_tap_extent(&lo, &hi);
+
+	// Taps are read from the seam buffer unless the loop is too short for
+	// the buffer to make sense
+	const auto seam_tap = [&seam, range, use_buffer](int tap) -> const float*
+	{
+		if (!use_buffer) return nullptr;
+		if (tap >= range.end - SEAM_FRAMES && tap < range.end + SEAM_FRAMES) return &seam.frames[tap - (range.end - SEAM_FRAMES)];
+		if (tap >= range.beg - SEAM_FRAMES && tap < range.beg + SEAM_FRAMES) return &seam.frames[SEAM_FRAMES + (tap - range.beg)];
+
+		return nullptr;
+	};
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto first { pos.prev[i] - lo };
+		const auto last { pos.prev[i] + hi };
+
+		if (first >= range.beg && last < range.end) continue;
+
+		std::array<float, simd::SINC_TAPS> y;
+
+		auto covered { true };
+
+		for (int k = 0; k <= lo + hi; k++)
+		{
+			const auto tap { seam_tap(first + k) };
+
+			if (!tap) { covered = false; break; }
+
+			y[k] = *tap;
+		}
+
+		if (!covered)
+		{
+			for (int k = 0; k <= lo + hi; k++)
+			{
+				y[k] = read_tap(channel, first + k, true);
+			}
+		}
+
+		(*out)[i] = interp_one(y.data(), pos.x[i]);
+	}
+}
+
+// [y] is the taps from get_tap_extent()
+inline float SampleData::interp_one(const float* y, float x) const
+{
+	switch (interp_mode_)
+	{
+		case InterpMode::cubic: return simd::hermite_one(y, x);
+		case InterpMode::sinc: return simd::sinc_one(y, x);
+		default: return (x * (y[1] - y[0])) + y[0];
 	}
-	
-	return math::wrap(pos - std::int32_t(info_->loop_points[0].value), float(loop_length_.value)) + std::int32_t(info_->loop_points[0].value);
 }
 
 inline auto SampleData::get_interp_pos(float pos, bool loop) const -> InterpPos
@@ -135,32 +571,43 @@ inline auto SampleData::get_interp_pos(float pos, bool loop) const -> InterpPos
 	out.prev = int(std::floor(pos));
 
 	out.x = pos - out.prev;
+	out.loop = loop;
 
 	return out;
 }
 
-inline auto SampleData::get_interp_pos(snd::frame_vec<64> pos, bool loop) const -> InterpVectorPos
+inline auto SampleData::get_wrapped_interp_pos(const snd::frame_vec<64>& pos, bool loop) const -> InterpVectorPos
 {
 	InterpVectorPos out;
 
-	if (loop)
+	alignas(32) std::array<double, kFloatsPerDSPVector> positions;
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
 	{
-		pos = get_loop_pos(pos);
+		positions[i] = pos[i];
 	}
 
-	const auto next  = math::ceil(pos);
-	const auto prev  = math::floor(pos);
-	const auto fract = math::fract(pos);
+	simd::split_positions(positions.data(), out.prev.getBuffer(), out.x.getBuffer());
 
-	for (int i = 0; i < kFloatsPerDSPVector; i++) {
-		out.next[i] = static_cast<int>(next[i]);
-		out.prev[i] = static_cast<int>(prev[i]);
-		out.x[i]    = static_cast<float>(fract[i]);
+	// If the position is exactly on a frame then x is zero and it
+	// doesn't matter what next is
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		out.next[i] = out.prev[i] + 1;
 	}
 
 	if (loop)
 	{
-		out.next[kFloatsPerDSPVector - 1] %= info_->num_frames.value;
+		const auto range { get_loop_range() };
+
+		int lo, hi;
+
+		get_tap_extent(&lo, &hi);
+
+		for (int i = 0; i < kFloatsPerDSPVector; i++)
+		{
+			out.seam = out.seam || out.prev[i] - lo < range.beg || out.prev[i] + hi >= range.end;
+		}
 	}
 
 	return out;
@@ -170,32 +617,565 @@ inline float SampleData::read_frame_interp(blink_ChannelCount channel, float pos
 {
 	const auto interp_pos = get_interp_pos(pos, loop);
 
-	const auto next_value = read_frame(channel, interp_pos.next);
-	const auto prev_value = read_frame(channel, interp_pos.prev);
+	switch (interp_mode_)
+	{
+		case InterpMode::cubic:
+		{
+			std::array<float, 4> y;
+
+			for (int k = 0; k < 4; k++) y[k] = read_tap(channel, interp_pos.prev + k - 1, interp_pos.loop);
+
+			return simd::hermite_one(y.data(), interp_pos.x);
+		}
+
+		case InterpMode::sinc:
+		{
+			std::array<float, simd::SINC_TAPS> y;
+
+			for (int k = 0; k < simd::SINC_TAPS; k++) y[k] = read_tap(channel, interp_pos.prev + k - (simd::SINC_TAPS / 2 - 1), interp_pos.loop);
+
+			return simd::sinc_one(y.data(), interp_pos.x);
+		}
+
+		default:
+		{
+			const auto next_value = read_tap(channel, interp_pos.next, interp_pos.loop);
+			const auto prev_value = read_tap(channel, interp_pos.prev, interp_pos.loop);
+
+			return (interp_pos.x * (next_value - prev_value)) + prev_value;
+		}
+	}
+}
+
+// Gathers [count] interpolation taps for each lane, starting at index + first.
+// taps is [count][kFloatsPerDSPVector]
+inline void SampleData::gather_taps(blink_ChannelCount channel, const ml::DSPVectorInt& index, int first, int count, float* taps) const
+{
+	const auto clusters { get_clusters(channel, index, index, -first, first + count - 1) };
+
+	if (clusters.count != 1)
+	{
+		std::fill(taps, taps + (count * kFloatsPerDSPVector), 0.0f);
+	}
+
+	StagingBuffer staging;
+
+	for (int c = 0; c < clusters.count; c++)
+	{
+		const auto& cluster { clusters.clusters[c] };
+		const auto frames { fetch_span(channel, cluster.span, staging.data()) };
+
+		for (int k = 0; k < count; k++)
+		{
+			const auto out { taps + (k * kFloatsPerDSPVector) };
+
+			if (clusters.count == 1)
+			{
+				simd::gather(frames, cluster.span.beg - (first + k), cluster.span.size(), index.getConstBuffer(), out);
+				continue;
+			}
+
+			alignas(32) float part[kFloatsPerDSPVector];
+
+			simd::gather(frames, cluster.span.beg - (first + k), cluster.span.size(), index.getConstBuffer(), part);
+			merge(cluster, part, out);
+		}
+	}
+}
+
+inline ml::DSPVector SampleData::read_frames_interp(blink_ChannelCount channel, const InterpVectorPos& pos) const
+{
+	auto out { read_frames_kernel(channel, pos) };
+
+	if (pos.seam) patch_seam(channel, pos, &out);
+
+	return out;
+}
+
+inline ml::DSPVector SampleData::read_frames_kernel(blink_ChannelCount channel, const InterpVectorPos& pos) const
+{
+	switch (interp_mode_)
+	{
+		case InterpMode::cubic:
+		{
+			alignas(32) float taps[4 * kFloatsPerDSPVector];
+			ml::DSPVector out;
+
+			gather_taps(channel, pos.prev, -1, 4, taps);
+			simd::hermite(taps, pos.x.getConstBuffer(), out.getBuffer());
 
-	return (interp_pos.x * (next_value - prev_value)) + prev_value;
+			return out;
+		}
+
+		case InterpMode::sinc:
+		{
+			alignas(32) float taps[simd::SINC_TAPS * kFloatsPerDSPVector];
+			ml::DSPVector out;
+
+			gather_taps(channel, pos.prev, -(simd::SINC_TAPS / 2 - 1), simd::SINC_TAPS, taps);
+			simd::sinc(taps, pos.x.getConstBuffer(), out.getBuffer());
+
+			return out;
+		}
+
+		default:
+		{
+			return read_frames_linear(channel, pos);
+		}
+	}
+}
+
+inline ml::DSPVector SampleData::read_frames_linear(blink_ChannelCount channel, const InterpVectorPos& pos) const
+{
+	// The previous and next frames are gathered from the same spans, so
+	// this is usually one host callback per channel per vector.
+	const auto clusters { get_clusters(channel, pos.prev, pos.next) };
+
+	StagingBuffer staging;
+	ml::DSPVector out(0.0f);
+
+	for (int c = 0; c < clusters.count; c++)
+	{
+		const auto& cluster { clusters.clusters[c] };
+		const auto frames { fetch_span(channel, cluster.span, staging.data()) };
+
+		if (clusters.count == 1)
+		{
+			simd::gather_lerp(frames, cluster.span.beg, cluster.span.size(), pos.prev.getConstBuffer(), pos.next.getConstBuffer(), pos.x.getConstBuffer(), out.getBuffer());
+			break;
+		}
+
+		ml::DSPVector part;
+
+		simd::gather_lerp(frames, cluster.span.beg, cluster.span.size(), pos.prev.getConstBuffer(), pos.next.getConstBuffer(), pos.x.getConstBuffer(), part.getBuffer());
+		merge(cluster, part.getConstBuffer(), out.getBuffer());
+	}
+
+	return out;
+}
+
+// Every interpolation kernel is the identity when x is zero so integer
+// positions can skip interpolation altogether.
+inline bool SampleData::get_stride(const snd::frame_vec<64>& pos, Stride* out) const
+{
+	const auto first { pos[0] };
+	const auto step { pos[1] - pos[0] };
+
+	if (first != std::floor(first) || step != std::floor(step)) return false;
+	if (std::abs(first) > double(std::numeric_limits<int>::max() / 2)) return false;
+	if (std::abs(step) > double(std::numeric_limits<int>::max() / (2 * kFloatsPerDSPVector))) return false;
+
+	for (int i = 2; i < kFloatsPerDSPVector; i++)
+	{
+		if (pos[i] != first + (double(i) * step)) return false;
+	}
+
+	out->first = int(first);
+	out->step = int(step);
+
+	return true;
+}
+
+inline ml::DSPVector SampleData::read_frames_stride(blink_ChannelCount channel, Stride stride) const
+{
+	const auto last { stride.first + ((kFloatsPerDSPVector - 1) * stride.step) };
+
+	Span span { std::min(stride.first, last), std::max(stride.first, last) + 1 };
+
+	span.beg = std::max(span.beg, 0);
+	span.end = std::min(span.end, int(info_->num_frames.value));
+
+	if (span.size() <= 0) return ml::DSPVector(0.0f);
+
+	ml::DSPVector out;
+
+	if (span.size() > MAX_SPAN && !get_direct(channel))
+	{
+		ml::DSPVectorInt index;
+
+		for (int i = 0; i < kFloatsPerDSPVector; i++)
+		{
+			index[i] = stride.first + (i * stride.step);
+		}
+
+		return read_frames(channel, index);
+	}
+
+	StagingBuffer staging;
+
+	const auto frames { fetch_span(channel, span, staging.data()) };
+
+	if (stride.step == 1)
+	{
+		const auto lead { span.beg - stride.first };
+		const auto buffer { out.getBuffer() };
+
+		std::fill(buffer, buffer + lead, 0.0f);
+		std::copy(frames, frames + span.size(), buffer + lead);
+		std::fill(buffer + lead + span.size(), buffer + kFloatsPerDSPVector, 0.0f);
+
+		return out;
+	}
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto rel { stride.first + (i * stride.step) - span.beg };
+
+		out[i] = rel >= 0 && rel < span.size() ? frames[rel] : 0.0f;
+	}
+
+	return out;
 }
 
 inline ml::DSPVector SampleData::read_frames_interp(blink_ChannelCount channel, const snd::frame_vec<64>& pos, bool loop) const
 {
-	const auto interp_pos = get_interp_pos(pos, loop);
+	// Wrapped once for both
+	const auto wrapped_pos { loop ? get_loop_pos(pos) : pos };
 
-	const auto next_value = read_frames(channel, interp_pos.next);
-	const auto prev_value = read_frames(channel, interp_pos.prev);
+	Stride stride;
 
-	return (interp_pos.x * (next_value - prev_value)) + prev_value;
+	if (get_stride(wrapped_pos, &stride)) return read_frames_stride(channel, stride);
+
+	return read_frames_interp(channel, get_wrapped_interp_pos(wrapped_pos, loop));
 }
 
 template <std::size_t ROWS> [[nodiscard]]
 auto SampleData::read_frames_interp(const snd::frame_vec<64>& pos, bool loop) const -> ml::DSPVectorArray<ROWS> {
 	ml::DSPVectorArray<ROWS> out; 
-	const auto interp_pos = get_interp_pos(pos, loop); 
+	const auto wrapped_pos = loop ? get_loop_pos(pos) : pos;
+	Stride stride;
+	if (get_stride(wrapped_pos, &stride)) {
+		for (int r = 0; r < ROWS; r++) {
+			out.row(r) = read_frames_stride({uint8_t(r)}, stride);
+		}
+		return out;
+	}
+	const auto interp_pos = get_wrapped_interp_pos(wrapped_pos, loop); 
+	for (int r = 0; r < ROWS; r++) {
+		out.row(r) = read_frames_interp({uint8_t(r)}, interp_pos);
+	} 
+	return out;
+}
+
+inline void SampleData::read_ahead(const snd::frame_vec<64>& pos, const ml::DSPVector& derivatives, bool loop, int vectors) const
+{
+	if (!info_->read_ahead || info_->num_frames.value == 0) return;
+
+	const auto distance { double(kFloatsPerDSPVector) * vectors };
+
+	auto beg { std::numeric_limits<double>::max() };
+	auto end { std::numeric_limits<double>::lowest() };
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto predicted { pos[i] + (double(derivatives[i]) * distance) };
+
+		beg = std::min({beg, pos[i], predicted});
+		end = std::max({end, pos[i], predicted});
+	}
+
+	const auto num_frames { double(info_->num_frames.value) };
+
+	const auto request = [this, num_frames](double beg, double end)
+	{
+		beg = std::clamp(std::floor(beg) - 1.0, 0.0, num_frames);
+		end = std::clamp(std::ceil(end) + 2.0, 0.0, num_frames);
+
+		if (end > beg) info_->read_ahead(info_->host, {uint64_t(beg)}, {uint64_t(end)});
+	};
+
+	if (!loop)
+	{
+		request(beg, end);
+		return;
+	}
+
+	const auto loop_beg { info_->loop_points ? double(info_->loop_points[0].value) : 0.0 };
+	const auto loop_end { info_->loop_points ? double(info_->loop_points[1].value) : num_frames };
+	const auto loop_length { loop_end - loop_beg };
+
+	// Wrapped around the loop. Just ask for the whole thing if it goes
+	// round more than once.
+	if (loop_length <= 0.0 || end - beg >= loop_length)
+	{
+		request(loop_beg, loop_end);
+		return;
+	}
+
+	const auto wrapped_beg { math::wrap(beg - loop_beg, loop_length) + loop_beg };
+	const auto wrapped_end { wrapped_beg + (end - beg) };
+
+	request(wrapped_beg, std::min(wrapped_end, loop_end));
+
+	if (wrapped_end > loop_end) request(loop_beg, loop_beg + (wrapped_end - loop_end));
+}
+
+template <std::size_t ROWS> [[nodiscard]]
+auto SampleData::read_frames_interp(const snd::frame_vec<64>& pos, bool loop, PyramidLevel level) const -> ml::DSPVectorArray<ROWS> {
+	auto out = read_level<ROWS>(level.level, pos, loop);
+	if (level.prev != level.level) {
+		auto from = read_level<ROWS>(level.prev, pos, loop);
+		for (int r = 0; r < ROWS; r++) {
+			crossfade(from.row(r), &out.row(r));
+		}
+	}
+	return out;
+}
+
+template <std::size_t ROWS> [[nodiscard]]
+auto SampleData::read_level(int level, const snd::frame_vec<64>& pos, bool loop) const -> ml::DSPVectorArray<ROWS> {
+	if (level == 0) {
+		return read_frames_interp<ROWS>(pos, loop);
+	}
+	ml::DSPVectorArray<ROWS> out; 
+	const auto interp_pos = get_level_interp_pos(level, pos, loop); 
 	for (int r = 0; r < ROWS; r++) {
-		const auto next_value = read_frames({uint8_t(r)}, interp_pos.next);
-		const auto prev_value = read_frames({uint8_t(r)}, interp_pos.prev); 
-		out.row(r) = (interp_pos.x * (next_value - prev_value)) + prev_value;
+		out.row(r) = read_level_interp(level, {uint8_t(r)}, interp_pos);
 	} 
 	return out;
 }
 
+inline ml::DSPVector SampleData::read_frames_interp(blink_ChannelCount channel, const snd::frame_vec<64>& pos, bool loop, PyramidLevel level) const
+{
+	auto out { read_level(level.level, channel, pos, loop) };
+
+	if (level.prev != level.level) crossfade(read_level(level.prev, channel, pos, loop), &out);
+
+	return out;
+}
+
+inline ml::DSPVector SampleData::read_level(int level, blink_ChannelCount channel, const snd::frame_vec<64>& pos, bool loop) const
+{
+	if (level == 0) return read_frames_interp(channel, pos, loop);
+
+	return read_level_interp(level, channel, get_level_interp_pos(level, pos, loop));
+}
+
+// Linear fade from [from] to [to] across the vector
+inline void SampleData::crossfade(const ml::DSPVector& from, ml::DSPVector* to)
+{
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto x { (float(i) + 0.5f) / kFloatsPerDSPVector };
+
+		(*to)[i] = from[i] + (x * ((*to)[i] - from[i]));
+	}
+}
+
+inline void SampleData::update_pyramid_level(const ml::DSPVector& derivatives, PyramidLevel* level) const
+{
+	level->prev = level->level;
+	level->level = get_pyramid_level(derivatives, level->level);
+}
+
+// Level N is used for rates in [2^N, 2^(N+1)), so it is never read
+// faster than 2x. Going down a level waits until the rate is a bit below
+// that, so a rate hovering around a boundary doesn't keep switching.
+inline int SampleData::get_pyramid_level(const ml::DSPVector& derivatives, int current) const
+{
+	if (!pyramid_) return 0;
+
+	auto max_rate { 0.0f };
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		max_rate = std::max(max_rate, std::abs(derivatives[i]));
+	}
+
+	const auto num_levels { pyramid_->get_num_levels() };
+	const auto level = [num_levels](float rate)
+	{
+		if (!(rate >= 2.0f)) return 0;
+
+		return std::min(int(std::log2(rate)), num_levels - 1);
+	};
+
+	const auto up { level(max_rate) };
+
+	if (up >= current) return up;
+
+	return std::min(current, level(max_rate / LEVEL_HYSTERESIS));
+}
+
+inline auto SampleData::get_level_interp_pos(int level, snd::frame_vec<64> pos, bool loop) const -> InterpVectorPos
+{
+	InterpVectorPos out;
+
+	// Positions are wrapped in level 0 frames. Taps which cross the loop
+	// seam are dealt with by patch_level_seam().
+	if (loop)
+	{
+		pos = get_loop_pos(pos);
+	}
+
+	const auto scale { 1.0 / double(1 << level) };
+
+	alignas(32) std::array<double, kFloatsPerDSPVector> positions;
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		positions[i] = double(pos[i]) * scale;
+	}
+
+	simd::split_positions(positions.data(), out.prev.getBuffer(), out.x.getBuffer());
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		out.next[i] = out.prev[i] + 1;
+	}
+
+	// Lanes near enough to the loop points to be read from the pyramid's
+	// seam buffers, which includes any whose taps cross the seam
+	if (loop)
+	{
+		const auto range { get_loop_range() };
+		const auto beg { (range.beg >> level) + SamplePyramid::SEAM_FRAMES };
+		const auto end { (range.end >> level) - SamplePyramid::SEAM_FRAMES };
+
+		int lo, hi;
+
+		get_tap_extent(&lo, &hi);
+
+		for (int i = 0; i < kFloatsPerDSPVector; i++)
+		{
+			out.seam = out.seam || out.prev[i] - lo < beg || out.prev[i] + hi >= end;
+		}
+	}
+
+	return out;
+}
+
+inline ml::DSPVector SampleData::read_level_interp(int level, blink_ChannelCount channel, const InterpVectorPos& pos) const
+{
+	auto out { read_level_kernel(level, channel, pos) };
+
+	if (pos.seam) patch_level_seam(level, channel, pos, &out);
+
+	return out;
+}
+
+// Taps near the loop points are read from the pyramid's seam buffers. If
+// it was built with different loop points, taps past one end of the loop
+// are instead wrapped round to the other in level 0 frames (the loop
+// points generally fall between the frames of a level) and read from the
+// level with linear interpolation.
+inline void SampleData::patch_level_seam(int level, blink_ChannelCount channel, const InterpVectorPos& pos, ml::DSPVector* out) const
+{
+	const auto frames { pyramid_->get_level_frames(level, channel) };
+
+	if (!frames) return;
+
+	const auto size { pyramid_->get_level_size(level) };
+	const auto range { get_loop_range() };
+	const auto scale { 1.0 / double(1 << level) };
+	const auto seams { std::array{pyramid_->get_seam(level, channel, range.beg, range.end, 0), pyramid_->get_seam(level, channel, range.beg, range.end, 1)} };
+	const auto beg { double(range.beg) * scale };
+	const auto end { double(range.end) * scale };
+
+	if (!(end > beg)) return;
+
+	const auto frame = [frames, size](int index)
+	{
+		return index >= 0 && index < size ? frames[index] : 0.0f;
+	};
+
+	const auto seam_taps = [&seams](int first, int count) -> const float*
+	{
+		for (const auto seam : seams)
+		{
+			if (seam && first >= seam->first && first + count <= seam->first + int(seam->frames.size())) return &seam->frames[first - seam->first];
+		}
+
+		return nullptr;
+	};
+
+	const auto read = [&frame, beg, end](double tap)
+	{
+		if (tap < beg || tap >= end) tap = math::wrap(tap - beg, end - beg) + beg;
+
+		const auto index { int(std::floor(tap)) };
+		const auto x { float(tap - index) };
+
+		return frame(index) + (x * (frame(index + 1) - frame(index)));
+	};
+
+	int lo, hi;
+
+	get_tap_extent(&lo, &hi);
+
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto first { pos.prev[i] - lo };
+		const auto last { pos.prev[i] + hi };
+
+		if (const auto taps = seam_taps(first, lo + hi + 1))
+		{
+			(*out)[i] = interp_one(taps, pos.x[i]);
+			continue;
+		}
+
+		if (first >= beg && last < end) continue;
+
+		std::array<float, simd::SINC_TAPS> y;
+
+		for (int k = 0; k <= lo + hi; k++)
+		{
+			y[k] = read(double(first + k));
+		}
+
+		(*out)[i] = interp_one(y.data(), pos.x[i]);
+	}
+}
+
+// The pyramid levels are resident so there is no span to fetch. Taps
+// outside the level read as silence.
+inline ml::DSPVector SampleData::read_level_kernel(int level, blink_ChannelCount channel, const InterpVectorPos& pos) const
+{
+	const auto frames { pyramid_->get_level_frames(level, channel) };
+
+	if (!frames) return ml::DSPVector(0.0f);
+
+	const auto size { pyramid_->get_level_size(level) };
+
+	ml::DSPVector out;
+
+	switch (interp_mode_)
+	{
+		case InterpMode::cubic:
+		{
+			alignas(32) float taps[4 * kFloatsPerDSPVector];
+
+			for (int k = 0; k < 4; k++)
+			{
+				simd::gather(frames, 1 - k, size, pos.prev.getConstBuffer(), taps + (k * kFloatsPerDSPVector));
+			}
+
+			simd::hermite(taps, pos.x.getConstBuffer(), out.getBuffer());
+
+			return out;
+		}
+
+		case InterpMode::sinc:
+		{
+			alignas(32) float taps[simd::SINC_TAPS * kFloatsPerDSPVector];
+
+			for (int k = 0; k < simd::SINC_TAPS; k++)
+			{
+				simd::gather(frames, (simd::SINC_TAPS / 2 - 1) - k, size, pos.prev.getConstBuffer(), taps + (k * kFloatsPerDSPVector));
+			}
+
+			simd::sinc(taps, pos.x.getConstBuffer(), out.getBuffer());
+
+			return out;
+		}
+
+		default:
+		{
+			simd::gather_lerp(frames, 0, size, pos.prev.getConstBuffer(), pos.next.getConstBuffer(), pos.x.getConstBuffer(), out.getBuffer());
+
+			return out;
+		}
+	}
+}
+
 } // blink
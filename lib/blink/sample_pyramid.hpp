@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <blink.h>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// A mip-map of progressively 2x-decimated, band-limited copies of a
+// sample. Level 0 is the sample itself and is not stored here. Level N
+// runs at 1/2^N the sample rate, so reading it at a rate of r is
+// equivalent to reading the original at r * 2^N without the aliasing
+// or the cache misses.
+//
+// Intended to be built by a sampler plugin during
+// blink_sampler_analyze_sample() and handed to SampleData.
+//
+// Each level also keeps the frames either side of the loop points as they
+// would be if the level had been decimated from the looped sample, so
+// reading across the loop seam doesn't pick up what is on the other side
+// of the loop points.
+
+namespace blink {
+
+class SamplePyramid {
+public:
+	static constexpr auto MAX_LEVELS = 8;
+	// Don't bother decimating any further than this
+	static constexpr auto MIN_LEVEL_FRAMES = 64;
+
+	[[nodiscard]] auto build(void* host, blink_AnalysisCallbacks callbacks, const blink_SampleInfo& info) -> blink_AnalysisResult;
+	[[nodiscard]] auto get_id() const -> blink_ID { return id_; }
+	[[nodiscard]] auto get_num_levels() const -> int { return int(levels_.size()) + 1; }
+	// Level must be at least 1
+	[[nodiscard]] auto get_level_frames(int level, blink_ChannelCount channel) const -> const float*;
+	[[nodiscard]] auto get_level_size(int level) const -> int;
+	static constexpr auto SEAM_FRAMES = 32;
+	struct Seam {
+		// The level frame which frames[0] stands in for
+		int first;
+		std::array<float, SEAM_FRAMES * 2> frames;
+	};
+	// [side] is 0 for the loop start and 1 for the loop end. Null if the
+	// pyramid was built with different loop points.
+	[[nodiscard]] auto get_seam(int level, blink_ChannelCount channel, int loop_beg, int loop_end, int side) const -> const Seam*;
+private:
+	using Channel = std::vector<float>;
+	struct Level {
+		std::vector<Channel> channels;
+		std::vector<std::array<Seam, 2>> seams;
+		int size = 0;
+	};
+	static constexpr auto HALF_BAND_TAPS   = 31;
+	static constexpr auto HALF_BAND_CENTER = HALF_BAND_TAPS / 2;
+	static constexpr auto READ_CHUNK       = 4096;
+	using HalfBandKernel = std::array<float, HALF_BAND_TAPS>;
+	[[nodiscard]] static auto make_half_band_kernel() -> HalfBandKernel;
+	[[nodiscard]] static auto read_channel(const blink_SampleInfo& info, blink_ChannelCount channel) -> Channel;
+	static auto decimate(const Channel& in, Channel* out) -> void;
+	auto build_seams(const Channel& in, blink_ChannelCount channel) -> void;
+	blink_ID id_ = {0};
+	std::vector<Level> levels_;
+	int loop_beg_ = 0;
+	int loop_end_ = 0;
+};
+
+// Blackman-windowed sinc with its cutoff at half the Nyquist frequency.
+// Every other tap (apart from the center) is zero, which decimate()
+// takes advantage of.
+inline auto SamplePyramid::make_half_band_kernel() -> HalfBandKernel {
+	static constexpr auto PI = 3.14159265358979323846;
+	HalfBandKernel out;
+	auto sum = 0.0;
+	for (int k = 0; k < HALF_BAND_TAPS; k++) {
+		const auto d      = double(k - HALF_BAND_CENTER);
+		const auto sinc   = d == 0.0 ? 0.5 : std::sin(PI * d * 0.5) / (PI * d);
+		const auto w      = double(k) / (HALF_BAND_TAPS - 1);
+		const auto window = 0.42 - (0.5 * std::cos(2.0 * PI * w)) + (0.08 * std::cos(4.0 * PI * w));
+		out[k] = float(sinc * window);
+		sum   += sinc * window;
+	}
+	for (auto& h : out) {
+		h = float(h / sum);
+	}
+	return out;
+}
+
+inline auto SamplePyramid::read_channel(const blink_SampleInfo& info, blink_ChannelCount channel) -> Channel {
+	Channel out(info.num_frames.value, 0.0f);
+	if (info.channel_data) {
+		std::copy(info.channel_data[channel.value], info.channel_data[channel.value] + out.size(), out.begin());
+		return out;
+	}
+	for (uint64_t i = 0; i < out.size(); i += READ_CHUNK) {
+		const auto size = std::min(uint64_t(READ_CHUNK), out.size() - i);
+		// Anything the host can't give us yet is left as silence
+		info.get_data(info.host, channel, {i}, {size}, out.data() + i);
+	}
+	return out;
+}
+
+// out[m] = sum_k h[k] * in[2m + k - center], treating anything outside the
+// input as silence
+inline auto SamplePyramid::decimate(const Channel& in, Channel* out) -> void {
+	static const auto h = make_half_band_kernel();
+	const auto in_size  = int(in.size());
+	out->resize((in.size() + 1) / 2);
+	for (int m = 0; m < int(out->size()); m++) {
+		const auto center = 2 * m;
+		auto sum          = h[HALF_BAND_CENTER] * in[center];
+		for (int k = 1; k <= HALF_BAND_CENTER; k += 2) {
+			const auto a = center - k;
+			const auto b = center + k;
+			const auto x = (a >= 0 ? in[a] : 0.0f) + (b < in_size ? in[b] : 0.0f);
+			sum += h[HALF_BAND_CENTER + k] * x;
+		}
+		(*out)[m] = sum;
+	}
+}
+
+// Decimates a window of the looped sample around each loop point. The
+// window starts on a frame which is a multiple of every level's step so
+// its frames line up with the levels', and is wide enough that the
+// silence past its edges never reaches the frames which are kept.
+inline auto SamplePyramid::build_seams(const Channel& in, blink_ChannelCount channel) -> void {
+	const auto length = loop_end_ - loop_beg_;
+	const auto align  = 1 << int(levels_.size());
+	const auto reach  = (SEAM_FRAMES + HALF_BAND_TAPS) * align;
+	const auto floor_div = [](int x, int y) {
+		return (x / y) - (x % y < 0 ? 1 : 0);
+	};
+	for (int side = 0; side < 2; side++) {
+		const auto point = side == 0 ? loop_beg_ : loop_end_;
+		const auto first = floor_div(point - reach, align) * align;
+		Channel window((reach * 2) + align);
+		for (int i = 0; i < int(window.size()); i++) {
+			const auto offset = (first + i - loop_beg_) % length;
+			window[i] = in[loop_beg_ + (offset < 0 ? offset + length : offset)];
+		}
+		for (int l = 0; l < int(levels_.size()); l++) {
+			Channel next;
+			decimate(window, &next);
+			window = std::move(next);
+			const auto step = 2 << l;
+			auto& seam = levels_[l].seams[channel.value][side];
+			seam.first = floor_div(point, step) - SEAM_FRAMES;
+			const auto beg = window.begin() + (seam.first - (first / step));
+			std::copy(beg, beg + seam.frames.size(), seam.frames.begin());
+		}
+	}
+}
+
+inline auto SamplePyramid::build(void* host, blink_AnalysisCallbacks callbacks, const blink_SampleInfo& info) -> blink_AnalysisResult {
+	id_ = info.id;
+	levels_.clear();
+	auto num_levels = 0;
+	for (auto size = info.num_frames.value; num_levels < MAX_LEVELS - 1 && size / 2 >= MIN_LEVEL_FRAMES; size /= 2) {
+		num_levels++;
+	}
+	if (num_levels == 0) {
+		return blink_AnalysisResult_OK;
+	}
+	levels_.resize(num_levels);
+	for (auto& level : levels_) {
+		level.channels.resize(info.num_channels.value);
+		level.seams.resize(info.num_channels.value);
+	}
+	// The same loop SampleData uses
+	loop_beg_ = info.loop_points ? int(info.loop_points[0].value) : 0;
+	loop_end_ = info.loop_points ? int(info.loop_points[1].value) : int(info.num_frames.value);
+	const auto has_seams = loop_beg_ >= 0 && loop_end_ > loop_beg_ && uint64_t(loop_end_) <= info.num_frames.value;
+	if (!has_seams) {
+		loop_beg_ = loop_end_ = 0;
+	}
+	const auto total_steps = float(info.num_channels.value * num_levels);
+	for (uint8_t c = 0; c < info.num_channels.value; c++) {
+		auto prev = read_channel(info, {c});
+		if (has_seams) {
+			build_seams(prev, {c});
+		}
+		for (int l = 0; l < num_levels; l++) {
+			if (callbacks.should_abort && callbacks.should_abort(host)) {
+				levels_.clear();
+				return blink_AnalysisResult_Abort;
+			}
+			auto& channel = levels_[l].channels[c];
+			decimate(prev, &channel);
+			levels_[l].size = int(channel.size());
+			prev = channel;
+			if (callbacks.report_progress) {
+				callbacks.report_progress(host, float((c * num_levels) + l + 1) / total_steps);
+			}
+		}
+	}
+	return blink_AnalysisResult_OK;
+}
+
+inline auto SamplePyramid::get_level_frames(int level, blink_ChannelCount channel) const -> const float* {
+	const auto& channels = levels_[level - 1].channels;
+	if (channel.value >= channels.size()) {
+		return nullptr;
+	}
+	return channels[channel.value].data();
+}
+
+inline auto SamplePyramid::get_level_size(int level) const -> int {
+	return levels_[level - 1].size;
+}
+
+inline auto SamplePyramid::get_seam(int level, blink_ChannelCount channel, int loop_beg, int loop_end, int side) const -> const Seam* {
+	if (loop_beg != loop_beg_ || loop_end != loop_end_ || loop_end_ == loop_beg_) {
+		return nullptr;
+	}
+	const auto& seams = levels_[level - 1].seams;
+	if (channel.value >= seams.size()) {
+		return nullptr;
+	}
+	return &seams[channel.value][side];
+}
+
+} // blink
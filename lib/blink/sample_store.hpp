@@ -0,0 +1,662 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <blink.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Holds sample data losslessly compressed in fixed-size blocks, decoding
+// them on demand into a bounded cache. Can serve blink_SampleInfo::get_data
+// and read_ahead directly (see SampleStore::Source.)
+//
+// Reads on the audio thread never block or allocate. A block which isn't
+// in the cache is decoded straight into the reader's buffer, which costs
+// at most one block's worth of decoding, and is counted as a miss. It is
+// also requested from a background thread, which decodes it into the
+// cache so that it will be there next time.
+//
+// Compression is per block. Each frame is predicted from the previous two
+// by whichever fixed linear predictor (none, x1 or 2*x1 - x2) suits the
+// block best, and the residuals are zigzagged and Rice-coded with a
+// per-block parameter.
+//
+// Blocks which were converted from 16- or 24-bit integers are predicted
+// and coded as those integers. Anything else is predicted in floating
+// point, and the residual is the difference between the bit patterns of
+// the frame and the prediction, mapped to integers which preserve
+// ordering, so it is still lossless. Noise doesn't compress, but never
+// grows by more than a few bits per frame.
+
+namespace blink {
+namespace sample_store {
+
+static constexpr auto BLOCK_FRAMES = 4096;
+
+struct EncodedBlock {
+	std::vector<uint32_t> words;
+	int frames = 0;
+	int k      = 0;
+	int order  = 0;
+	// If non-zero the frames are integers divided by 2^shift
+	int shift  = 0;
+};
+
+namespace codec {
+
+// Rice quotients larger than this are escaped and written raw
+static constexpr uint32_t ESCAPE = 32;
+
+[[nodiscard]] inline
+auto to_ordered(float f) -> uint32_t {
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+[[nodiscard]] inline
+auto from_ordered(uint32_t u) -> float {
+	const auto bits = u & 0x80000000u ? u & 0x7fffffffu : ~u;
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+[[nodiscard]] inline auto zigzag(int32_t v) -> uint32_t { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+[[nodiscard]] inline auto unzigzag(uint32_t u) -> int32_t { return int32_t(u >> 1) ^ -int32_t(u & 1); }
+
+struct BitWriter {
+	std::vector<uint32_t>* words;
+	uint64_t acc = 0;
+	int bits     = 0;
+	auto write(uint32_t value, int count) -> void {
+		acc  |= uint64_t(value) << bits;
+		bits += count;
+		if (bits >= 32) {
+			words->push_back(uint32_t(acc));
+			acc  >>= 32;
+			bits  -= 32;
+		}
+	}
+	auto flush() -> void {
+		if (bits > 0) {
+			words->push_back(uint32_t(acc));
+		}
+		acc  = 0;
+		bits = 0;
+	}
+};
+
+struct BitReader {
+	const uint32_t* words;
+	size_t next  = 0;
+	uint64_t acc = 0;
+	int bits     = 0;
+	auto read(int count) -> uint32_t {
+		if (count == 0) {
+			return 0;
+		}
+		if (bits < count) {
+			acc  |= uint64_t(words[next++]) << bits;
+			bits += 32;
+		}
+		const auto out = uint32_t(acc & ((uint64_t(1) << count) - 1));
+		acc  >>= count;
+		bits  -= count;
+		return out;
+	}
+};
+
+// Picks the Rice parameter from the mean residual
+[[nodiscard]] inline
+auto choose_k(const uint32_t* residuals, int count) -> int {
+	uint64_t sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += residuals[i];
+	}
+	const auto mean = sum / uint64_t(std::max(count, 1));
+	auto k = 0;
+	while (k < 31 && (uint64_t(1) << (k + 1)) <= mean) {
+		k++;
+	}
+	return k;
+}
+
+static constexpr auto MAX_ORDER = 2;
+
+// A NaN prediction isn't guaranteed to come out the same way twice, so
+// fall back to the previous frame
+[[nodiscard]] inline
+auto predict(int order, float x1, float x2) -> float {
+	switch (order) {
+		case 0: { return 0.0f; }
+		case 1: { return x1; }
+		default: {
+			const auto p = (2.0f * x1) - x2;
+			return std::isnan(p) ? x1 : p;
+		}
+	}
+}
+
+[[nodiscard]] inline
+auto predict(int order, int32_t x1, int32_t x2) -> int32_t {
+	switch (order) {
+		case 0: { return 0; }
+		case 1: { return x1; }
+		default: { return (2 * x1) - x2; }
+	}
+}
+
+[[nodiscard]] inline auto residual(float x, float p) -> uint32_t { return zigzag(int32_t(to_ordered(x) - to_ordered(p))); }
+[[nodiscard]] inline auto residual(int32_t x, int32_t p) -> uint32_t { return zigzag(x - p); }
+[[nodiscard]] inline auto unresidual(float p, uint32_t r) -> float { return from_ordered(to_ordered(p) + uint32_t(unzigzag(r))); }
+[[nodiscard]] inline auto unresidual(int32_t p, uint32_t r) -> int32_t { return p + unzigzag(r); }
+
+// Returns the smallest shift (16- or 24-bit sources) for which every frame
+// is an integer divided by 2^shift, or zero if there isn't one
+[[nodiscard]] inline
+auto find_integer_shift(const float* frames, int count) -> int {
+	for (const auto shift : {15, 23}) {
+		const auto scale = float(1 << shift);
+		const auto limit = float(1 << (shift + 1));
+		auto ok = true;
+		for (int i = 0; i < count && ok; i++) {
+			const auto x = frames[i] * scale;
+			ok = std::abs(x) <= limit && x == std::nearbyint(x) && to_ordered((float(int32_t(x)) / scale)) == to_ordered(frames[i]);
+		}
+		if (ok) {
+			return shift;
+		}
+	}
+	return 0;
+}
+
+// Writes the residuals of [frames] under the predictor which gives the
+// smallest, and returns the order
+template <typename T> [[nodiscard]]
+auto get_residuals(const T* frames, int count, uint32_t* out) -> int {
+	std::array<uint64_t, MAX_ORDER + 1> sums = {};
+	auto x1 = T{};
+	auto x2 = T{};
+	for (int i = 0; i < count; i++) {
+		for (int order = 0; order <= MAX_ORDER; order++) {
+			sums[order] += residual(frames[i], predict(order, x1, x2));
+		}
+		x2 = x1;
+		x1 = frames[i];
+	}
+	const auto order = int(std::min_element(sums.begin(), sums.end()) - sums.begin());
+	x1 = T{};
+	x2 = T{};
+	for (int i = 0; i < count; i++) {
+		out[i] = residual(frames[i], predict(order, x1, x2));
+		x2     = x1;
+		x1     = frames[i];
+	}
+	return order;
+}
+
+// Calls fn(i, x) for each of the first [end] frames
+template <typename T, typename Fn>
+auto decode(BitReader* reader, const EncodedBlock& block, int end, Fn&& fn) -> void {
+	auto x1 = T{};
+	auto x2 = T{};
+	for (int i = 0; i < end; i++) {
+		uint32_t q = 0;
+		while (q < ESCAPE && reader->read(1)) {
+			q++;
+		}
+		const auto r = q >= ESCAPE ? reader->read(32) : (q << block.k) | reader->read(block.k);
+		const auto x = unresidual(predict(block.order, x1, x2), r);
+		fn(i, x);
+		x2 = x1;
+		x1 = x;
+	}
+}
+
+[[nodiscard]] inline
+auto encode(const float* frames, int count) -> EncodedBlock {
+	EncodedBlock out;
+	out.frames = count;
+	out.shift  = find_integer_shift(frames, count);
+	std::vector<uint32_t> residuals(count);
+	if (out.shift > 0) {
+		std::vector<int32_t> ints(count);
+		for (int i = 0; i < count; i++) {
+			ints[i] = int32_t(frames[i] * float(1 << out.shift));
+		}
+		out.order = get_residuals(ints.data(), count, residuals.data());
+	}
+	else {
+		out.order = get_residuals(frames, count, residuals.data());
+	}
+	out.k = choose_k(residuals.data(), count);
+	BitWriter writer{&out.words};
+	for (const auto r : residuals) {
+		const auto q = r >> out.k;
+		if (q >= ESCAPE) {
+			writer.write(0xffffffffu, 32);
+			writer.write(r, 32);
+			continue;
+		}
+		// Unary quotient, terminated by a zero bit
+		writer.write((1u << q) - 1, int(q) + 1);
+		if (out.k > 0) {
+			writer.write(r & ((1u << out.k) - 1), out.k);
+		}
+	}
+	writer.flush();
+	out.words.shrink_to_fit();
+	return out;
+}
+
+// Decodes frames [first, first + count) of the block into [out]. The
+// frames before [first] have to be decoded too, but aren't stored, so no
+// other memory is needed.
+inline
+auto decode(const EncodedBlock& block, int first, int count, float* out) -> void {
+	BitReader reader{block.words.data()};
+	const auto end   = std::min(first + count, block.frames);
+	const auto store = [first, out](int i, float x) {
+		if (i >= first) out[i - first] = x;
+	};
+	if (block.shift == 0) {
+		decode<float>(&reader, block, end, store);
+		return;
+	}
+	const auto scale = float(1 << block.shift);
+	decode<int32_t>(&reader, block, end, [scale, &store](int i, int32_t x) { store(i, float(x) / scale); });
+}
+
+inline
+auto decode(const EncodedBlock& block, float* out) -> void {
+	decode(block, 0, block.frames, out);
+}
+
+} // codec
+} // sample_store
+
+class SampleStore {
+	struct Sample;
+public:
+	static constexpr auto BLOCK_FRAMES = sample_store::BLOCK_FRAMES;
+	struct Stats {
+		uint64_t hits         = 0; // Blocks
+		uint64_t misses       = 0; // Blocks
+		uint64_t loads        = 0; // Blocks
+		uint64_t encoded_size = 0; // Bytes
+		uint64_t decoded_size = 0; // Bytes
+	};
+	// Returned by add(). Passed as blink_SampleInfo::host along with
+	// get_data() and read_ahead(). Reads go straight to the compressed
+	// sample without looking it up, so as with any other sample data, the
+	// host mustn't remove or replace the sample while a plugin might be
+	// reading it.
+	struct Source {
+		SampleStore* store;
+		blink_ID id;
+		const Sample* sample;
+	};
+	// Memory for the cache is allocated up front
+	explicit SampleStore(int cache_blocks);
+	~SampleStore();
+	SampleStore(const SampleStore&) = delete;
+	SampleStore& operator=(const SampleStore&) = delete;
+	// Compresses the sample. Replaces any sample previously added with
+	// this id
+	[[nodiscard]] auto add(blink_ID id, blink_ChannelCount num_channels, blink_FrameCount num_frames, const float* const* channel_data) -> Source;
+	auto remove(blink_ID id) -> void;
+	// Safe to call from the audio thread. Blocks which aren't in the
+	// cache are decoded straight into [buffer] and requested, so that
+	// they will be next time.
+	[[nodiscard]] auto get_data(const Source& source, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount;
+	// Safe to call from the audio thread. Requests that every channel of
+	// frames [beg, end) be decoded.
+	auto read_ahead(const Source& source, blink_FrameCount beg, blink_FrameCount end) -> void;
+	[[nodiscard]] auto get_stats() const -> Stats;
+	auto reset_stats() -> void;
+	static auto get_data(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount;
+	static auto read_ahead(void* host, blink_FrameCount beg, blink_FrameCount end) -> void;
+private:
+	static constexpr auto WAYS     = 4;
+	static constexpr auto REQUESTS = 256;
+	static constexpr auto NO_ID    = std::numeric_limits<int64_t>::min();
+	// Never changes once added
+	struct Sample {
+		uint64_t num_frames = 0;
+		std::vector<std::vector<sample_store::EncodedBlock>> channels;
+	};
+	struct Key {
+		int64_t id;
+		uint64_t block_channel; // Block << 8 | channel
+	};
+	// The cache is set-associative. A block can only live in the WAYS
+	// slots of the set its key hashes to, and the least recently used of
+	// those is replaced. Readers look blocks up without locking, the same
+	// way SampleStream's do: the sequence number is odd while the decoder
+	// is writing to the slot, and the frames are only ever accessed
+	// atomically.
+	struct Slot {
+		std::atomic<int64_t> id             = NO_ID;
+		std::atomic<uint64_t> block_channel = 0;
+		std::atomic<uint64_t> sequence      = 0;
+		std::atomic<uint64_t> frames        = 0;
+		std::atomic<uint64_t> last_used     = 0;
+	};
+	// Misses are queued here for the decoder, direct-mapped by key. If
+	// the entry is taken the request is dropped, and made again on the
+	// next miss.
+	struct Request {
+		static constexpr uint32_t EMPTY = 0;
+		static constexpr uint32_t BUSY  = 1;
+		static constexpr uint32_t FULL  = 2;
+		std::atomic<uint32_t> state = EMPTY;
+		std::atomic<int64_t> id = NO_ID;
+		std::atomic<uint64_t> block_channel = 0;
+	};
+	// The low bits have to differ between neighbouring blocks, which
+	// only differ in the high bits of block_channel, so mix everything
+	[[nodiscard]] static auto hash(Key key) -> size_t {
+		auto x = (uint64_t(key.id) * 0x9e3779b97f4a7c15ull) + key.block_channel;
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ull;
+		x ^= x >> 33;
+		return size_t(x);
+	}
+	[[nodiscard]] auto slot_frames(int slot_index) -> float* { return frames_.data() + (size_t(slot_index) * BLOCK_FRAMES); }
+	auto request(Key key) -> void;
+	auto try_read(Key key, uint64_t offset, uint64_t count, float* buffer) -> bool;
+	auto invalidate(int slot_index) -> void;
+	// Must be called with the mutex held
+	auto load(Key key) -> void;
+	auto decoder_thread() -> void;
+	// Guards samples_. Only taken by add(), remove() and the decoder.
+	std::mutex mutex_;
+	std::unordered_map<int64_t, Sample> samples_;
+	int num_sets_;
+	std::vector<Slot> slots_;
+	std::vector<float> frames_;
+	std::vector<Request> requests_;
+	// The decoder writes each block here first, so that a slot is only
+	// unreadable while it is being copied into
+	std::vector<float> scratch_;
+	std::atomic<bool> quit_ = false;
+	std::atomic<bool> pending_ = false;
+	std::counting_semaphore<> wakeup_{0};
+	std::atomic<uint64_t> clock_  = 0;
+	std::atomic<uint64_t> hits_   = 0;
+	std::atomic<uint64_t> misses_ = 0;
+	std::atomic<uint64_t> loads_  = 0;
+	std::atomic<uint64_t> encoded_size_ = 0;
+	std::atomic<uint64_t> decoded_size_ = 0;
+	std::thread decoder_;
+};
+
+inline
+SampleStore::SampleStore(int cache_blocks)
+	: num_sets_{std::max((cache_blocks + WAYS - 1) / WAYS, 1)}
+	, slots_(size_t(num_sets_) * WAYS)
+	, frames_(slots_.size() * BLOCK_FRAMES)
+	, requests_(REQUESTS)
+	, scratch_(BLOCK_FRAMES)
+{
+	decoder_ = std::thread{[this] { decoder_thread(); }};
+}
+
+inline
+SampleStore::~SampleStore() {
+	quit_ = true;
+	wakeup_.release();
+	decoder_.join();
+}
+
+inline
+auto SampleStore::add(blink_ID id, blink_ChannelCount num_channels, blink_FrameCount num_frames, const float* const* channel_data) -> Source {
+	Sample sample;
+	sample.num_frames = num_frames.value;
+	sample.channels.resize(num_channels.value);
+	uint64_t encoded_size = 0;
+	for (int c = 0; c < num_channels.value; c++) {
+		for (uint64_t beg = 0; beg < num_frames.value; beg += BLOCK_FRAMES) {
+			const auto count = int(std::min(uint64_t(BLOCK_FRAMES), num_frames.value - beg));
+			sample.channels[c].push_back(sample_store::codec::encode(channel_data[c] + beg, count));
+			encoded_size += sample.channels[c].back().words.size() * sizeof(uint32_t);
+		}
+	}
+	remove(id);
+	std::lock_guard lock{mutex_};
+	encoded_size_ += encoded_size;
+	decoded_size_ += num_frames.value * num_channels.value * sizeof(float);
+	auto& stored = samples_[id.value];
+	stored = std::move(sample);
+	return {this, id, &stored};
+}
+
+inline
+auto SampleStore::remove(blink_ID id) -> void {
+	std::lock_guard lock{mutex_};
+	const auto pos = samples_.find(id.value);
+	if (pos == samples_.end()) {
+		return;
+	}
+	for (const auto& channel : pos->second.channels) {
+		for (const auto& block : channel) {
+			encoded_size_ -= block.words.size() * sizeof(uint32_t);
+		}
+	}
+	decoded_size_ -= pos->second.num_frames * pos->second.channels.size() * sizeof(float);
+	samples_.erase(pos);
+	for (int i = 0; i < int(slots_.size()); i++) {
+		if (slots_[i].id.load(std::memory_order_relaxed) == int64_t(id.value)) {
+			invalidate(i);
+		}
+	}
+}
+
+inline
+auto SampleStore::request(Key key) -> void {
+	auto& entry   = requests_[hash(key) % requests_.size()];
+	auto expected = Request::EMPTY;
+	if (!entry.state.compare_exchange_strong(expected, Request::BUSY, std::memory_order_acquire)) {
+		return;
+	}
+	entry.id.store(key.id, std::memory_order_relaxed);
+	entry.block_channel.store(key.block_channel, std::memory_order_relaxed);
+	entry.state.store(Request::FULL, std::memory_order_release);
+	if (!pending_.exchange(true, std::memory_order_acq_rel)) {
+		wakeup_.release();
+	}
+}
+
+inline
+auto SampleStore::try_read(Key key, uint64_t offset, uint64_t count, float* buffer) -> bool {
+	const auto set = int(hash(key) % size_t(num_sets_));
+	for (int way = 0; way < WAYS; way++) {
+		const auto slot_index = (set * WAYS) + way;
+		auto& slot            = slots_[slot_index];
+		const auto seq0       = slot.sequence.load(std::memory_order_acquire);
+		if (seq0 & 1 || slot.id.load(std::memory_order_relaxed) != key.id || slot.block_channel.load(std::memory_order_relaxed) != key.block_channel) {
+			continue;
+		}
+		const auto frames = slot_frames(slot_index) + offset;
+		const auto loaded = slot.frames.load(std::memory_order_relaxed);
+		const auto valid  = std::min(count, loaded > offset ? loaded - offset : 0);
+		for (uint64_t i = 0; i < valid; i++) {
+			buffer[i] = std::atomic_ref<float>{frames[i]}.load(std::memory_order_relaxed);
+		}
+		std::fill(buffer + valid, buffer + count, 0.0f);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != seq0) {
+			return false;
+		}
+		slot.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+inline
+auto SampleStore::get_data(const Source& source, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount {
+	const auto& sample = *source.sample;
+	if (channel.value >= sample.channels.size() || index.value >= sample.num_frames) {
+		return {0};
+	}
+	const auto end = std::min(index.value + size.value, sample.num_frames);
+	for (auto frame = index.value; frame < end;) {
+		const auto block  = frame / BLOCK_FRAMES;
+		const auto offset = frame % BLOCK_FRAMES;
+		const auto count  = std::min(BLOCK_FRAMES - offset, end - frame);
+		const auto out    = buffer + (frame - index.value);
+		const auto key    = Key{int64_t(source.id.value), (block << 8) | channel.value};
+		if (try_read(key, offset, count, out)) {
+			hits_.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			sample_store::codec::decode(sample.channels[channel.value][block], int(offset), int(count), out);
+			misses_.fetch_add(1, std::memory_order_relaxed);
+			request(key);
+		}
+		frame += count;
+	}
+	return {end - index.value};
+}
+
+inline
+auto SampleStore::read_ahead(const Source& source, blink_FrameCount beg, blink_FrameCount end) -> void {
+	const auto& sample = *source.sample;
+	if (sample.num_frames == 0 || beg.value >= sample.num_frames) {
+		return;
+	}
+	// Only as much as would fit in the cache
+	const auto budget = slots_.size() / std::max<size_t>(sample.channels.size(), 1);
+	const auto first  = beg.value / BLOCK_FRAMES;
+	const auto last   = std::min({(std::max(end.value, beg.value + 1) - 1) / BLOCK_FRAMES, (sample.num_frames - 1) / BLOCK_FRAMES, first + std::max<size_t>(budget, 1) - 1});
+	float probe;
+	for (auto block = first; block <= last; block++) {
+		for (uint8_t c = 0; c < uint8_t(sample.channels.size()); c++) {
+			const auto key = Key{int64_t(source.id.value), (block << 8) | c};
+			if (!try_read(key, 0, 0, &probe)) {
+				request(key);
+			}
+		}
+	}
+}
+
+inline
+auto SampleStore::invalidate(int slot_index) -> void {
+	auto& slot = slots_[slot_index];
+	slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+	slot.id.store(NO_ID, std::memory_order_relaxed);
+	slot.sequence.fetch_add(1, std::memory_order_release);
+}
+
+inline
+auto SampleStore::load(Key key) -> void {
+	const auto pos = samples_.find(key.id);
+	if (pos == samples_.end()) {
+		return;
+	}
+	const auto channel = key.block_channel & 0xff;
+	const auto block   = key.block_channel >> 8;
+	if (channel >= pos->second.channels.size() || block >= pos->second.channels[channel].size()) {
+		return;
+	}
+	const auto set = int(hash(key) % size_t(num_sets_));
+	for (int way = 0; way < WAYS; way++) {
+		const auto& slot = slots_[(set * WAYS) + way];
+		if (slot.id.load(std::memory_order_relaxed) == key.id && slot.block_channel.load(std::memory_order_relaxed) == key.block_channel) {
+			return;
+		}
+	}
+	// Replace an empty way if there is one, otherwise the least recently
+	// used
+	auto victim = set * WAYS;
+	for (int way = 0; way < WAYS; way++) {
+		const auto slot_index = (set * WAYS) + way;
+		const auto& slot      = slots_[slot_index];
+		if (slot.id.load(std::memory_order_relaxed) == NO_ID) {
+			victim = slot_index;
+			break;
+		}
+		if (slot.last_used.load(std::memory_order_relaxed) < slots_[victim].last_used.load(std::memory_order_relaxed)) {
+			victim = slot_index;
+		}
+	}
+	const auto& encoded = pos->second.channels[channel][block];
+	sample_store::codec::decode(encoded, scratch_.data());
+	auto& slot = slots_[victim];
+	slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+	slot.id.store(NO_ID, std::memory_order_relaxed);
+	const auto out = slot_frames(victim);
+	for (int i = 0; i < encoded.frames; i++) {
+		std::atomic_ref<float>{out[i]}.store(scratch_[i], std::memory_order_relaxed);
+	}
+	slot.frames.store(uint64_t(encoded.frames), std::memory_order_relaxed);
+	slot.block_channel.store(key.block_channel, std::memory_order_relaxed);
+	slot.id.store(key.id, std::memory_order_relaxed);
+	slot.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+	slot.sequence.fetch_add(1, std::memory_order_release);
+	loads_.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline
+auto SampleStore::decoder_thread() -> void {
+	for (;;) {
+		wakeup_.acquire();
+		if (quit_) {
+			return;
+		}
+		pending_.exchange(false, std::memory_order_acq_rel);
+		std::lock_guard lock{mutex_};
+		for (auto& entry : requests_) {
+			if (entry.state.load(std::memory_order_acquire) != Request::FULL) {
+				continue;
+			}
+			const auto key = Key{entry.id.load(std::memory_order_relaxed), entry.block_channel.load(std::memory_order_relaxed)};
+			entry.state.store(Request::EMPTY, std::memory_order_release);
+			load(key);
+		}
+	}
+}
+
+inline
+auto SampleStore::get_data(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount {
+	const auto source = static_cast<const Source*>(host);
+	return source->store->get_data(*source, channel, index, size, buffer);
+}
+
+inline
+auto SampleStore::read_ahead(void* host, blink_FrameCount beg, blink_FrameCount end) -> void {
+	const auto source = static_cast<const Source*>(host);
+	source->store->read_ahead(*source, beg, end);
+}
+
+inline
+auto SampleStore::get_stats() const -> Stats {
+	Stats out;
+	out.hits         = hits_;
+	out.misses       = misses_;
+	out.loads        = loads_;
+	out.encoded_size = encoded_size_;
+	out.decoded_size = decoded_size_;
+	return out;
+}
+
+inline
+auto SampleStore::reset_stats() -> void {
+	hits_   = 0;
+	misses_ = 0;
+	loads_  = 0;
+}
+
+} // blink
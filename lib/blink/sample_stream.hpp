@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <blink.h>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+// Streams a sample from slow storage through a ring of pre-read blocks.
+//
+// The ring is filled by a background thread which calls a blocking reader
+// supplied by the host (e.g. pread() or a file decoder.) Reads on the audio
+// thread never block or allocate. If a block isn't resident yet it reads
+// as silence and is counted as a miss, and the block is requested so it
+// will be there next time. Plugins can reduce misses by calling
+// blink_SampleInfo::read_ahead for the positions they expect to reach
+// (see SampleData::read_ahead.)
+//
+// Pass a SampleStream* as blink_SampleInfo::host, along with
+// SampleStream::get_data and SampleStream::read_ahead.
+
+namespace blink {
+
+class SampleStream {
+public:
+	static constexpr auto BLOCK_FRAMES = 4096;
+	// Blocking. Reads [size] frames of every channel starting at [index]
+	// into [buffers] (one per channel), returning the number of frames read.
+	using Reader = std::function<uint64_t(uint64_t index, uint64_t size, float* const* buffers)>;
+	struct Stats {
+		uint64_t hits   = 0; // Blocks
+		uint64_t misses = 0; // Blocks
+		uint64_t loads  = 0; // Blocks
+	};
+	SampleStream(blink_ChannelCount num_channels, blink_FrameCount num_frames, int ring_blocks, Reader reader);
+	~SampleStream();
+	SampleStream(const SampleStream&) = delete;
+	SampleStream& operator=(const SampleStream&) = delete;
+	// Safe to call from the audio thread
+	[[nodiscard]] auto get_data(blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount;
+	// Safe to call from the audio thread. Requests that frames from [beg]
+	// to [end] be made resident. Only as much as fits in the ring is
+	// requested.
+	auto read_ahead(blink_FrameCount beg, blink_FrameCount end) -> void;
+	[[nodiscard]] auto get_stats() const -> Stats;
+	auto reset_stats() -> void;
+	static auto get_data(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount;
+	static auto read_ahead(void* host, blink_FrameCount beg, blink_FrameCount end) -> void;
+private:
+	static constexpr auto NO_BLOCK = std::numeric_limits<uint64_t>::max();
+	// Blocks are direct-mapped into the ring by block % ring size. The
+	// sequence number is odd while the loader is writing to the slot, so
+	// a reader can tell if the slot changed underneath it. The frames are
+	// only ever accessed atomically (relaxed) because a reader can be
+	// copying them while the loader overwrites them.
+	struct Slot {
+		std::atomic<uint64_t> wanted = NO_BLOCK;
+		std::atomic<uint64_t> loaded = NO_BLOCK;
+		std::atomic<uint64_t> sequence = 0;
+		std::atomic<uint64_t> frames = 0;
+	};
+	auto request(uint64_t block) -> void;
+	auto try_read(uint64_t block, uint8_t channel, uint64_t offset, uint64_t count, float* buffer) -> bool;
+	auto load(int slot_index, uint64_t block) -> void;
+	auto loader_thread() -> void;
+	[[nodiscard]] auto slot_frames(int slot_index, uint8_t channel) -> float* { return frames_.data() + ((size_t(slot_index) * num_channels_) + channel) * BLOCK_FRAMES; }
+	uint8_t num_channels_;
+	uint64_t num_frames_;
+	Reader reader_;
+	std::vector<Slot> slots_;
+	std::vector<float> frames_;
+	// The Reader writes each block here first, so that a slot is only
+	// unreadable while it is being copied into, not for the whole read
+	std::vector<float> scratch_;
+	std::atomic<bool> quit_ = false;
+	std::atomic<bool> pending_ = false;
+	// Released once each time pending_ goes from false to true, and on
+	// quitting. Releasing doesn't block or take a lock, and unlike a
+	// condition variable the wakeup can't be missed.
+	std::counting_semaphore<> wakeup_{0};
+	std::atomic<uint64_t> hits_   = 0;
+	std::atomic<uint64_t> misses_ = 0;
+	std::atomic<uint64_t> loads_  = 0;
+	std::thread loader_;
+};
+
+inline
+SampleStream::SampleStream(blink_ChannelCount num_channels, blink_FrameCount num_frames, int ring_blocks, Reader reader)
+	: num_channels_{num_channels.value}
+	, num_frames_{num_frames.value}
+	, reader_{std::move(reader)}
+	, slots_(std::max(ring_blocks, 1))
+	, frames_(slots_.size() * num_channels.value * BLOCK_FRAMES)
+	, scratch_(size_t(num_channels.value) * BLOCK_FRAMES)
+{
+	loader_ = std::thread{[this] { loader_thread(); }};
+}
+
+inline
+SampleStream::~SampleStream() {
+	quit_ = true;
+	wakeup_.release();
+	loader_.join();
+}
+
+inline
+auto SampleStream::request(uint64_t block) -> void {
+	auto& slot = slots_[block % slots_.size()];
+	if (slot.wanted.exchange(block, std::memory_order_relaxed) != block) {
+		if (!pending_.exchange(true, std::memory_order_acq_rel)) {
+			wakeup_.release();
+		}
+	}
+}
+
+inline
+auto SampleStream::try_read(uint64_t block, uint8_t channel, uint64_t offset, uint64_t count, float* buffer) -> bool {
+	const auto slot_index = int(block % slots_.size());
+	auto& slot            = slots_[slot_index];
+	const auto seq0       = slot.sequence.load(std::memory_order_acquire);
+	if (seq0 & 1 || slot.loaded.load(std::memory_order_acquire) != block) {
+		return false;
+	}
+	const auto frames = slot_frames(slot_index, channel) + offset;
+	const auto loaded = slot.frames.load(std::memory_order_relaxed);
+	const auto valid  = std::min(count, loaded > offset ? loaded - offset : 0);
+	for (uint64_t i = 0; i < valid; i++) {
+		buffer[i] = std::atomic_ref<float>{frames[i]}.load(std::memory_order_relaxed);
+	}
+	std::fill(buffer + valid, buffer + count, 0.0f);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == seq0;
+}
+
+inline
+auto SampleStream::get_data(blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount {
+	if (channel.value >= num_channels_ || index.value >= num_frames_) {
+		return {0};
+	}
+	const auto end = std::min(index.value + size.value, num_frames_);
+	for (auto frame = index.value; frame < end;) {
+		const auto block  = frame / BLOCK_FRAMES;
+		const auto offset = frame % BLOCK_FRAMES;
+		const auto count  = std::min(BLOCK_FRAMES - offset, end - frame);
+		const auto out    = buffer + (frame - index.value);
+		if (try_read(block, channel.value, offset, count, out)) {
+			hits_.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			std::fill(out, out + count, 0.0f);
+			misses_.fetch_add(1, std::memory_order_relaxed);
+			request(block);
+		}
+		frame += count;
+	}
+	return {end - index.value};
+}
+
+inline
+auto SampleStream::read_ahead(blink_FrameCount beg, blink_FrameCount end) -> void {
+	if (num_frames_ == 0 || beg.value >= num_frames_) {
+		return;
+	}
+	const auto first = beg.value / BLOCK_FRAMES;
+	const auto last  = std::min({(std::max(end.value, beg.value + 1) - 1) / BLOCK_FRAMES, (num_frames_ - 1) / BLOCK_FRAMES, first + slots_.size() - 1});
+	for (auto block = first; block <= last; block++) {
+		const auto& slot = slots_[block % slots_.size()];
+		if (slot.loaded.load(std::memory_order_relaxed) != block) {
+			request(block);
+		}
+	}
+}
+
+inline
+auto SampleStream::load(int slot_index, uint64_t block) -> void {
+	auto& slot = slots_[slot_index];
+	float* buffers[256];
+	for (uint8_t c = 0; c < num_channels_; c++) {
+		buffers[c] = scratch_.data() + (size_t(c) * BLOCK_FRAMES);
+	}
+	const auto index  = block * BLOCK_FRAMES;
+	const auto size   = std::min(uint64_t(BLOCK_FRAMES), num_frames_ - index);
+	const auto frames = std::min(reader_(index, size, buffers), size);
+	slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+	slot.loaded.store(NO_BLOCK, std::memory_order_release);
+	for (uint8_t c = 0; c < num_channels_; c++) {
+		const auto out = slot_frames(slot_index, c);
+		for (uint64_t i = 0; i < frames; i++) {
+			std::atomic_ref<float>{out[i]}.store(buffers[c][i], std::memory_order_relaxed);
+		}
+	}
+	slot.frames.store(frames, std::memory_order_relaxed);
+	slot.loaded.store(block, std::memory_order_release);
+	slot.sequence.fetch_add(1, std::memory_order_release);
+	loads_.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline
+auto SampleStream::loader_thread() -> void {
+	for (;;) {
+		wakeup_.acquire();
+		if (quit_) {
+			return;
+		}
+		// Anything requested from here on wakes us up again. Exchanging
+		// rather than storing makes sure we see every slot.wanted which
+		// was set before pending_ was.
+		pending_.exchange(false, std::memory_order_acq_rel);
+		for (int i = 0; i < int(slots_.size()); i++) {
+			const auto wanted = slots_[i].wanted.load(std::memory_order_relaxed);
+			if (wanted != NO_BLOCK && wanted != slots_[i].loaded.load(std::memory_order_relaxed)) {
+				load(i, wanted);
+			}
+		}
+	}
+}
+
+inline
+auto SampleStream::get_stats() const -> Stats {
+	Stats out;
+	out.hits   = hits_;
+	out.misses = misses_;
+	out.loads  = loads_;
+	return out;
+}
+
+inline
+auto SampleStream::reset_stats() -> void {
+	hits_   = 0;
+	misses_ = 0;
+	loads_  = 0;
+}
+
+inline
+auto SampleStream::get_data(void* host, blink_ChannelCount channel, blink_FrameCount index, blink_FrameCount size, float* buffer) -> blink_FrameCount {
+	return static_cast<SampleStream*>(host)->get_data(channel, index, size, buffer);
+}
+
+inline
+auto SampleStream::read_ahead(void* host, blink_FrameCount beg, blink_FrameCount end) -> void {
+	static_cast<SampleStream*>(host)->read_ahead(beg, end);
+}
+
+} // blink
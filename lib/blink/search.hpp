@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <optional>
 #include <blink/block_positions.hpp>
 #include <blink/data.hpp>
 #include <blink/math.hpp>
@@ -189,13 +190,70 @@ auto step_forward(const blink_IntPoints& points, int64_t default_value, blink_Po
 	return step(points, default_value, block_position, search_beg_index, left, find);
 }
 
+// If the block positions are an increasing ramp which doesn't cross any
+// of the points, returns the index of the first point to the right of
+// the whole ramp. The values can then be found without searching for
+// each position.
+template <typename Point> [[nodiscard]]
+auto find_ramp_segment(const Point* points, size_t count, const BlockPositions& block_positions, int n) -> std::optional<size_t> {
+	if (!block_positions.is_increasing_ramp() || n < 1) {
+		return std::nullopt;
+	}
+	const auto less  = [](blink_Position position, const Point& point) { return position < point.x; };
+	const auto first = std::upper_bound(points, points + count, block_positions.get(0), less);
+	const auto last  = std::upper_bound(first, points + count, block_positions.get(n - 1), less);
+	if (first != last) {
+		return std::nullopt;
+	}
+	return size_t(std::distance(points, first));
+}
+
+// For the transform tables, which keep [count] sorted breakpoints.
+// Segment k is the span from breakpoint k - 1 to breakpoint k, so segment
+// 0 is everything before the first one and segment [count] is everything
+// after the last one. [get_x] is called as
+//
+//	blink_Position get_x(int k)
+//
+// to get the x of breakpoint k.
+
+// True if every position in [min, max] is in [segment]
+template <typename GetX> [[nodiscard]]
+auto in_segment(int count, const GetX& get_x, int segment, blink_Position min, blink_Position max) -> bool {
+	return (segment == 0 || get_x(segment - 1) <= min) && (segment == count || max < get_x(segment));
+}
+
+// Returns the segment containing [position], i.e. the index of the first
+// breakpoint to the right of it, or [count] if there isn't one. [hint] is
+// a previous result. Moving forwards from it is O(1) and anything else is
+// a binary search.
+template <typename GetX> [[nodiscard]]
+auto find_segment(int count, const GetX& get_x, blink_Position position, int hint) -> int {
+	if (hint <= count) {
+		if (in_segment(count, get_x, hint, position, position)) return hint;
+		if (hint < count && in_segment(count, get_x, hint + 1, position, position)) return hint + 1;
+	}
+	auto beg = 0;
+	auto end = count;
+	while (beg < end) {
+		const auto mid = beg + ((end - beg) / 2);
+		if (position < get_x(mid)) {
+			end = mid;
+		}
+		else {
+			beg = mid + 1;
+		}
+	}
+	return beg;
+}
+
 template <typename T, typename U, typename Searcher>
 auto vec(const U& data, const BlockPositions& block_positions, int n, Searcher searcher, T* out) -> void {
 	size_t left = 0;
 	bool reset = false;
 	auto prev_pos = block_positions.prev_pos; 
 	for (int i = 0; i < n; i++) {
-		const auto pos = block_positions.positions[i]; 
+		const auto pos = block_positions.get(i); 
 		if (pos < prev_pos) {
 			// This occurs when Blockhead loops back to an earlier song position.
 			// We perform a binary search to get back on track
@@ -203,10 +261,10 @@ auto vec(const U& data, const BlockPositions& block_positions, int n, Searcher s
 		} 
 		if (reset) {
 			reset = false; 
-			out[i] = searcher.binary(data, block_positions.positions[i], 0, &left);
+			out[i] = searcher.binary(data, pos, 0, &left);
 		}
 		else {
-			out[i] = searcher.forward(data, block_positions.positions[i], left, &left);
+			out[i] = searcher.forward(data, pos, left, &left);
 		} 
 		prev_pos = pos;
 	}
@@ -221,7 +279,13 @@ auto vec(const U& data, const BlockPositions& block_positions, Searcher searcher
 auto vec(const blink_UniformChordData& data, const BlockPositions& block_positions) -> ml::DSPVectorInt {
 	ml::DSPVectorInt out;
 	std::array<blink_Scale, kFloatsPerDSPVector> buffer; 
-	vec(data, block_positions, make_searcher(chord_binary, chord_forward), buffer.data()); 
+	if (find_ramp_segment(data.points.data, data.points.count, block_positions, block_positions.count)) {
+		size_t left;
+		buffer.fill(chord_binary(data, block_positions.get(0), 0, &left));
+	}
+	else {
+		vec(data, block_positions, make_searcher(chord_binary, chord_forward), buffer.data());
+	} 
 	for (int i = 0; i < kFloatsPerDSPVector; i++) {
 		out[i] = buffer[i];
 	} 
@@ -237,6 +301,25 @@ auto vec(float default_value, const blink_RealPoints& data, const BlockPositions
 	auto forward_search = [default_value](const blink_RealPoints& data, blink_Position position, size_t search_beg_index, size_t* left) -> float {
 		return float_points_forward(data, default_value, position, search_beg_index, left);
 	};
+	const auto n = block_positions.count;
+	if (const auto k = find_ramp_segment(data.data, data.count, block_positions, n)) {
+		if (data.count < 2 || *k == 0 || *k == data.count) {
+			size_t left;
+			out = float_points_binary(data, default_value, block_positions.get(0), 0, &left);
+			return out;
+		}
+		// Somewhere in between two envelope points
+		const auto& ramp        = *block_positions.ramp;
+		const auto p0           = data.data[*k - 1];
+		const auto p1           = data.data[*k];
+		const auto y0           = std::clamp(p0.y, data.min, data.max);
+		const auto y1           = std::clamp(p1.y, data.min, data.max);
+		const auto segment_size = p1.x - p0.x;
+		for (int i = 0; i < n; i++) {
+			out[i] = std::lerp(y0, y1, float((ramp.at(i) - p0.x) / segment_size));
+		}
+		return out;
+	}
 	vec(data, block_positions, make_searcher(binary_search, forward_search), out.getBuffer());
 	return out;
 } 
@@ -251,7 +334,13 @@ auto vec(int64_t default_value, const blink_IntPoints& data, const BlockPosition
 		return step_forward(data, default_value, position, search_beg_index, left);
 	};
 	std::array<int64_t, kFloatsPerDSPVector> buffer; 
-	vec(data, block_positions, make_searcher(binary_search, forward_search), buffer.data());
+	if (find_ramp_segment(data.data, data.count, block_positions, block_positions.count)) {
+		size_t left;
+		buffer.fill(step_binary(data, default_value, block_positions.get(0), 0, &left));
+	}
+	else {
+		vec(data, block_positions, make_searcher(binary_search, forward_search), buffer.data());
+	}
 	for (int i = 0; i < kFloatsPerDSPVector; i++) {
 		out[i] = static_cast<int>(buffer[i]);
 	} 
@@ -282,7 +371,7 @@ auto one(const blink::uniform::Env& env_data, blink_Position block_position) ->
 
 [[nodiscard]] inline
 auto one(const blink::uniform::Env& env_data, const BlockPositions& block_positions) -> float {
-	return one(env_data, block_positions.positions[0]);
+	return one(env_data, block_positions.get(0));
 }
 
 [[nodiscard]] inline
@@ -293,7 +382,7 @@ auto one(const blink::uniform::SliderReal& slider_data, blink_Position block_pos
 
 [[nodiscard]] inline
 auto one(const blink::uniform::SliderReal& slider_data, const BlockPositions& block_positions) -> float {
-	return one(slider_data, block_positions.positions[0]);
+	return one(slider_data, block_positions.get(0));
 }
 
 [[nodiscard]] inline
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <blink.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+// Kernels for the sample reading hot path. These operate on raw arrays of
+// BLINK_VECTOR_SIZE lanes. There is an AVX2 path, an SSE4.1 path where it
+// helps, and a scalar fallback which the compiler is free to vectorize
+// however it can.
+
+namespace blink {
+namespace simd {
+
+static constexpr auto LANES = BLINK_VECTOR_SIZE;
+
+// Splits frame positions into integer frame indices and fractional parts.
+// index[i] = floor(pos[i])
+// fract[i] = pos[i] - floor(pos[i])
+inline auto split_positions(const double* pos, int32_t* index, float* fract) -> void {
+#if defined(__AVX2__)
+	for (int i = 0; i < LANES; i += 4) {
+		const auto p = _mm256_loadu_pd(pos + i);
+		const auto f = _mm256_floor_pd(p);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(index + i), _mm256_cvttpd_epi32(f));
+		_mm_storeu_ps(fract + i, _mm256_cvtpd_ps(_mm256_sub_pd(p, f)));
+	}
+#elif defined(__SSE4_1__)
+	for (int i = 0; i < LANES; i += 4) {
+		const auto p0 = _mm_loadu_pd(pos + i);
+		const auto p1 = _mm_loadu_pd(pos + i + 2);
+		const auto f0 = _mm_floor_pd(p0);
+		const auto f1 = _mm_floor_pd(p1);
+		const auto idx = _mm_unpacklo_epi64(_mm_cvttpd_epi32(f0), _mm_cvttpd_epi32(f1));
+		const auto x   = _mm_movelh_ps(_mm_cvtpd_ps(_mm_sub_pd(p0, f0)), _mm_cvtpd_ps(_mm_sub_pd(p1, f1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(index + i), idx);
+		_mm_storeu_ps(fract + i, x);
+	}
+#else
+	for (int i = 0; i < LANES; i++) {
+		const auto f = std::floor(pos[i]);
+		index[i] = static_cast<int32_t>(f);
+		fract[i] = static_cast<float>(pos[i] - f);
+	}
+#endif
+}
+
+// Wraps positions into [beg, beg + length).
+// Positions are usually at most one loop length outside the range, so that
+// is handled with a conditional add or subtract. Otherwise falls back to
+// out[i] = x - length * floor(x / length)
+inline auto wrap(const double* pos, double beg, double length, double* out) -> void {
+	const auto end = beg + length;
+	auto in_reach  = true;
+	for (int i = 0; i < LANES; i++) {
+		in_reach = in_reach & (pos[i] >= beg - length) & (pos[i] < end + length);
+	}
+	if (in_reach) {
+#if defined(__AVX2__)
+		const auto vbeg = _mm256_set1_pd(beg);
+		const auto vend = _mm256_set1_pd(end);
+		const auto vlen = _mm256_set1_pd(length);
+		for (int i = 0; i < LANES; i += 4) {
+			const auto p   = _mm256_loadu_pd(pos + i);
+			const auto add = _mm256_and_pd(_mm256_cmp_pd(p, vbeg, _CMP_LT_OQ), vlen);
+			const auto sub = _mm256_and_pd(_mm256_cmp_pd(p, vend, _CMP_GE_OQ), vlen);
+			_mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_add_pd(p, add), sub));
+		}
+#else
+		for (int i = 0; i < LANES; i++) {
+			const auto p = pos[i];
+			out[i] = p < beg ? p + length : p >= end ? p - length : p;
+		}
+#endif
+		return;
+	}
+#if defined(__AVX2__)
+	const auto vbeg = _mm256_set1_pd(beg);
+	const auto vlen = _mm256_set1_pd(length);
+	for (int i = 0; i < LANES; i += 4) {
+		const auto x = _mm256_sub_pd(_mm256_loadu_pd(pos + i), vbeg);
+		const auto q = _mm256_floor_pd(_mm256_div_pd(x, vlen));
+		_mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_sub_pd(x, _mm256_mul_pd(vlen, q)), vbeg));
+	}
+#else
+	for (int i = 0; i < LANES; i++) {
+		const auto x = pos[i] - beg;
+		out[i] = x - (length * std::floor(x / length)) + beg;
+	}
+#endif
+}
+
+// out[i] = frames[index[i] - beg], or zero if that falls outside [0, size)
+inline auto gather(const float* frames, int beg, int size, const int32_t* index, float* out) -> void {
+#if defined(__AVX2__)
+	const auto vbeg  = _mm256_set1_epi32(beg);
+	const auto vsize = _mm256_set1_epi32(size);
+	const auto zero  = _mm256_setzero_si256();
+	for (int i = 0; i < LANES; i += 8) {
+		const auto rel  = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i)), vbeg);
+		const auto mask = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, rel), _mm256_cmpgt_epi32(vsize, rel));
+		_mm256_storeu_ps(out + i, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), frames, rel, _mm256_castsi256_ps(mask), 4));
+	}
+#else
+	for (int i = 0; i < LANES; i++) {
+		const auto rel = index[i] - beg;
+		out[i] = rel >= 0 && rel < size ? frames[rel] : 0.0f;
+	}
+#endif
+}
+
+// Gathers both interpolation taps and linearly interpolates between them
+// out[i] = lerp(frames[prev[i] - beg], frames[next[i] - beg], x[i])
+inline auto gather_lerp(const float* frames, int beg, int size, const int32_t* prev, const int32_t* next, const float* x, float* out) -> void {
+#if defined(__AVX2__)
+	const auto vbeg  = _mm256_set1_epi32(beg);
+	const auto vsize = _mm256_set1_epi32(size);
+	const auto zero  = _mm256_setzero_si256();
+	const auto in_range = [vsize, zero](__m256i rel) {
+		return _mm256_castsi256_ps(_mm256_andnot_si256(_mm256_cmpgt_epi32(zero, rel), _mm256_cmpgt_epi32(vsize, rel)));
+	};
+	for (int i = 0; i < LANES; i += 8) {
+		const auto rel0 = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i)), vbeg);
+		const auto rel1 = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(next + i)), vbeg);
+		const auto a    = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), frames, rel0, in_range(rel0), 4);
+		const auto b    = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), frames, rel1, in_range(rel1), 4);
+		const auto t    = _mm256_loadu_ps(x + i);
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(b, a)), a));
+	}
+#else
+	float a[LANES];
+	float b[LANES];
+	gather(frames, beg, size, prev, a);
+	gather(frames, beg, size, next, b);
+	for (int i = 0; i < LANES; i++) {
+		out[i] = (x[i] * (b[i] - a[i])) + a[i];
+	}
+#endif
+}
+
+// 4-point, 3rd-order Hermite (Catmull-Rom) interpolation
+// taps is [4][LANES], holding the frames at index-1, index, index+1 and
+// index+2 for each lane
+inline auto hermite(const float* taps, const float* x, float* out) -> void {
+	const auto ym1 = taps;
+	const auto y0  = taps + LANES;
+	const auto y1  = taps + LANES * 2;
+	const auto y2  = taps + LANES * 3;
+	for (int i = 0; i < LANES; i++) {
+		const auto c1 = 0.5f * (y1[i] - ym1[i]);
+		const auto c2 = ym1[i] - (2.5f * y0[i]) + (2.0f * y1[i]) - (0.5f * y2[i]);
+		const auto c3 = (0.5f * (y2[i] - ym1[i])) + (1.5f * (y0[i] - y1[i]));
+		out[i] = (((((c3 * x[i]) + c2) * x[i]) + c1) * x[i]) + y0[i];
+	}
+}
+
+[[nodiscard]] inline
+auto hermite_one(const float* y, float x) -> float {
+	const auto c1 = 0.5f * (y[2] - y[0]);
+	const auto c2 = y[0] - (2.5f * y[1]) + (2.0f * y[2]) - (0.5f * y[3]);
+	const auto c3 = (0.5f * (y[3] - y[0])) + (1.5f * (y[1] - y[2]));
+	return (((((c3 * x) + c2) * x) + c1) * x) + y[1];
+}
+
+// Polyphase windowed-sinc interpolation. The taps for each lane are the
+// frames from index-3 to index+4. Coefficients are interpolated between
+// the two nearest phases.
+static constexpr auto SINC_TAPS   = 8;
+static constexpr auto SINC_PHASES = 256;
+
+struct SincTable {
+	// One extra phase so that x=1 can be interpolated to without a wrap
+	std::array<float, (SINC_PHASES + 1) * SINC_TAPS> coefficients;
+};
+
+[[nodiscard]] inline
+auto make_sinc_table() -> SincTable {
+	static constexpr auto PI = 3.14159265358979323846;
+	SincTable out;
+	for (int p = 0; p <= SINC_PHASES; p++) {
+		const auto x = double(p) / SINC_PHASES;
+		auto sum     = 0.0;
+		for (int k = 0; k < SINC_TAPS; k++) {
+			const auto d      = double(k - (SINC_TAPS / 2 - 1)) - x;
+			const auto sinc   = d == 0.0 ? 1.0 : std::sin(PI * d) / (PI * d);
+			const auto w      = (d + (SINC_TAPS / 2)) / SINC_TAPS;
+			const auto window = 0.42 - (0.5 * std::cos(2.0 * PI * w)) + (0.08 * std::cos(4.0 * PI * w));
+			out.coefficients[(p * SINC_TAPS) + k] = float(sinc * window);
+			sum += sinc * window;
+		}
+		// Normalize for unity gain at DC
+		for (int k = 0; k < SINC_TAPS; k++) {
+			out.coefficients[(p * SINC_TAPS) + k] = float(out.coefficients[(p * SINC_TAPS) + k] / sum);
+		}
+	}
+	return out;
+}
+
+[[nodiscard]] inline
+auto sinc_table() -> const SincTable& {
+	static const auto table = make_sinc_table();
+	return table;
+}
+
+// taps is [SINC_TAPS][LANES]
+inline auto sinc(const float* taps, const float* x, float* out) -> void {
+	const auto& table = sinc_table().coefficients;
+	int32_t phase[LANES];
+	float t[LANES];
+	for (int i = 0; i < LANES; i++) {
+		// x can round up to exactly 1 when converted from double
+		const auto p  = x[i] * SINC_PHASES;
+		const auto ip = std::min(static_cast<int32_t>(p), SINC_PHASES - 1);
+		phase[i] = ip * SINC_TAPS;
+		t[i]     = p - static_cast<float>(ip);
+		out[i]   = 0.0f;
+	}
+	for (int k = 0; k < SINC_TAPS; k++) {
+		const auto y = taps + (k * LANES);
+		for (int i = 0; i < LANES; i++) {
+			const auto c0 = table[phase[i] + k];
+			const auto c1 = table[phase[i] + SINC_TAPS + k];
+			out[i] += y[i] * ((t[i] * (c1 - c0)) + c0);
+		}
+	}
+}
+
+[[nodiscard]] inline
+auto sinc_one(const float* y, float x) -> float {
+	const auto& table = sinc_table().coefficients;
+	const auto p      = x * SINC_PHASES;
+	const auto ip     = std::min(static_cast<int32_t>(p), SINC_PHASES - 1);
+	const auto phase  = ip * SINC_TAPS;
+	const auto t      = p - static_cast<float>(ip);
+	auto out          = 0.0f;
+	for (int k = 0; k < SINC_TAPS; k++) {
+		const auto c0 = table[phase + k];
+		const auto c1 = table[phase + SINC_TAPS + k];
+		out += y[k] * ((t * (c1 - c0)) + c0);
+	}
+	return out;
+}
+
+// Integer PCM to float, scaled to [-1, 1). count is any number of frames.
+inline auto int16_to_float(const int16_t* in, int count, float* out) -> void {
+	static constexpr auto SCALE = 1.0f / 32768.0f;
+	int i = 0;
+#if defined(__AVX2__)
+	const auto scale = _mm256_set1_ps(SCALE);
+	for (; i + 8 <= count; i += 8) {
+		const auto v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+#elif defined(__SSE4_1__)
+	const auto scale = _mm_set1_ps(SCALE);
+	for (; i + 4 <= count; i += 4) {
+		const auto v = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i)));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+#endif
+	for (; i < count; i++) {
+		out[i] = float(in[i]) * SCALE;
+	}
+}
+
+// in is packed signed little-endian 24 bit, 3 bytes per frame
+inline auto int24_to_float(const uint8_t* in, int count, float* out) -> void {
+	static constexpr auto SCALE = 1.0f / 8388608.0f;
+	int i = 0;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+	// Moves each 3 byte frame into the top of a 32 bit lane so that an
+	// arithmetic shift sign-extends it
+	const auto shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const auto scale   = _mm_set1_ps(SCALE);
+	// Each iteration loads 16 bytes to convert 12, so stop early enough
+	// not to read past the end
+	for (; i + 6 <= count; i += 4) {
+		const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + (i * 3)));
+		const auto v     = _mm_srai_epi32(_mm_shuffle_epi8(bytes, shuffle), 8);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+#endif
+	for (; i < count; i++) {
+		const auto b = in + (i * 3);
+		const auto v = int32_t(uint32_t(b[0]) << 8 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 24) >> 8;
+		out[i] = float(v) * SCALE;
+	}
+}
+
+// out[i] = 2^x[i], accurate to a couple of ulps. x must be within
+// [-1022, 1023]. It isn't clamped because that stops the compiler from
+// vectorizing the loop. Unlike std::exp2 there are no calls or branches.
+// count is any number of values.
+inline auto exp2(const double* x, int count, double* out) -> void {
+	static constexpr auto LN2 = 0.69314718055994530942;
+	for (int i = 0; i < count; i++) {
+		const auto v = x[i];
+		// Round to the nearest integer, biased so that it's positive and
+		// truncation works, and already in the form of a double exponent
+		const auto biased = int32_t(v + 1023.5);
+		// e^f with |f| <= ln(2)/2, Taylor series to the 13th power
+		const auto f = (v - double(biased - 1023)) * LN2;
+		auto p = 1.0 / 6227020800.0;
+		p = (p * f) + (1.0 / 479001600.0);
+		p = (p * f) + (1.0 / 39916800.0);
+		p = (p * f) + (1.0 / 3628800.0);
+		p = (p * f) + (1.0 / 362880.0);
+		p = (p * f) + (1.0 / 40320.0);
+		p = (p * f) + (1.0 / 5040.0);
+		p = (p * f) + (1.0 / 720.0);
+		p = (p * f) + (1.0 / 120.0);
+		p = (p * f) + (1.0 / 24.0);
+		p = (p * f) + (1.0 / 6.0);
+		p = (p * f) + 0.5;
+		p = (p * f) + 1.0;
+		p = (p * f) + 1.0;
+		const auto bits = uint64_t(uint32_t(biased)) << 52;
+		double scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		out[i] = p * scale;
+	}
+}
+
+} // simd
+} // blink
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <vector>
 #include <blink/math.hpp>
+#include <blink/search.hpp>
+#include <blink/simd.hpp>
 #include <blink/traverser.hpp>
 
 namespace blink {
@@ -57,69 +61,251 @@ auto make_pitch_point(const blink_RealPoint& p, float min, float max, float tran
 	return pp;
 }
 
-struct PitchUnit {
-	struct Config {
-		float transpose            = 0.0f;
-		const blink_UniformEnvData* pitch = nullptr;
-	};
-	// We use this for both sample playback and waveform generation. This
-	// calculation needs to be fast, preferably O(n) or better.
-	//
-	// If we are calculating waveforms the start of the waveform might be
-	// millions of pixels off the left edge of the screen therefore it is
-	// not good enough to simply traverse the entire sample.
-	//
-	blink_Position xform(Config config, blink_Position block_position, float* derivative = nullptr) {
-		for (int i = point_search_index_; i < config.pitch->points.count; i++) {
-			const auto p1 = make_pitch_point(config.pitch->points.data[i], config.pitch->points.min, config.pitch->points.max, config.transpose);
-			if (block_position < p1.x) {
-				if (i == 0) {
-					point_search_index_ = 0; 
-					if (derivative) {
-						*derivative = p1.ff;
-					}
-					return (block_position * p1.ff) + segment_start_;
-				} 
-				const auto p0     = make_pitch_point(config.pitch->points.data[i - 1], config.pitch->points.min, config.pitch->points.max, config.transpose); 
-				auto n            = block_position - p0.x;
-				auto segment_size = p1.x - p0.x;
-				if (segment_size > 0.0f) {
-					point_search_index_ = i; 
-					if (derivative) {
-						*derivative = float(weird_math_ff(double(p0.pitch), double(p1.pitch), segment_size, n)); 
-					}
-					return (weird_math(double(p0.pitch), double(p1.pitch), segment_size, n)) + segment_start_;
-				}
+// Cumulative integrals of the pitch envelope at each point, so that any
+// block position can be mapped to a sample position with a binary search
+// and one closed-form evaluation, rather than by walking every earlier
+// segment. We use this for both sample playback and waveform generation,
+// and if we are calculating waveforms the start of the waveform might be
+// millions of pixels off the left edge of the screen.
+//
+// Only rebuilt when the envelope changes.
+class PitchTable {
+public:
+	auto update(uint64_t unit_state_id, const blink_UniformEnvData* pitch, float transpose) -> void {
+		const Key key{unit_state_id, pitch->points.data, pitch->points.count, pitch->points.min, pitch->points.max, transpose};
+		if (key == key_ && !points_.empty()) {
+			return;
+		}
+		key_ = key;
+		version_++;
+		points_.resize(pitch->points.count);
+		starts_.resize(pitch->points.count);
+		for (size_t i = 0; i < points_.size(); i++) {
+			points_[i] = make_pitch_point(pitch->points.data[i], pitch->points.min, pitch->points.max, transpose);
+		}
+		ramps_.resize(pitch->points.count);
+		// The sample position reached at each point
+		starts_[0] = points_[0].x * points_[0].ff;
+		for (size_t i = 1; i < points_.size(); i++) {
+			const auto& p0          = points_[i - 1];
+			const auto& p1          = points_[i];
+			const auto segment_size = p1.x - p0.x;
+			starts_[i] = starts_[i - 1];
+			ramps_[i]  = make_ramp(p0, p1);
+			if (segment_size > 0.0) {
+				starts_[i] += ramps_[i].sum(ramps_[i].pow(segment_size), segment_size);
 			}
-			else {
-				if (i == 0) {
-					point_search_index_ = 1; 
-					segment_start_ += (p1.x * p1.ff) + segment_start_;
-				}
-				else {
-					point_search_index_ = i + 1; 
-					const auto p0 = make_pitch_point(config.pitch->points.data[i - 1], config.pitch->points.min, config.pitch->points.max, config.transpose); 
-					auto segment_size { p1.x - p0.x }; 
-					if (segment_size > 0.0f) {
-						segment_start_ = (weird_math(double(p0.pitch), double(p1.pitch), segment_size, segment_size)) + segment_start_;
-					}
-				}
+		}
+	}
+	// Returns the index of the first point to the right of the block
+	// position, or the number of points if there isn't one. [hint] is a
+	// previous result. Moving forwards from it is O(1).
+	[[nodiscard]] auto find_segment(blink_Position block_position, int hint) const -> int {
+		return search::find_segment(int(points_.size()), [this](int k) { return points_[k].x; }, block_position, hint);
+	}
+	// True if every position in [min, max] is in [segment]
+	[[nodiscard]] auto in_segment(int segment, blink_Position min, blink_Position max) const -> bool {
+		return search::in_segment(int(points_.size()), [this](int k) { return points_[k].x; }, segment, min, max);
+	}
+	[[nodiscard]] auto xform(int segment, blink_Position block_position, float* derivative = nullptr) const -> blink_Position {
+		if (segment == 0) {
+			const auto& p1 = points_[0];
+			if (derivative) {
+				*derivative = p1.ff;
+			}
+			return block_position * p1.ff;
+		}
+		if (segment == int(points_.size())) {
+			const auto& p0 = points_.back();
+			if (derivative) {
+				*derivative = p0.ff;
 			}
+			return ((block_position - p0.x) * p0.ff) + starts_.back();
 		}
-		const auto p0 = make_pitch_point(config.pitch->points.data[config.pitch->points.count - 1], config.pitch->points.min, config.pitch->points.max, config.transpose); 
-		auto n        = block_position - p0.x;
+		const auto& ramp = ramps_[segment];
+		const auto n     = block_position - points_[segment - 1].x;
+		return xform_ramp(segment, n, ramp.pow(n), derivative);
+	}
+	// Only for segments strictly between two points. [rn] is r^n, which
+	// the caller may have found without calling pow().
+	[[nodiscard]] auto xform_ramp(int segment, double n, double rn, float* derivative = nullptr) const -> blink_Position {
+		const auto& ramp = ramps_[segment];
 		if (derivative) {
-			*derivative = p0.ff; 
+			*derivative = float(ramp.ff_min * rn);
+		}
+		return ramp.sum(rn, n) + starts_[segment - 1];
+	}
+	// Transforms [count] positions which are all in [segment]. For a ramp,
+	// r^n is found for every position at once with simd::exp2() rather
+	// than with a pow() each. [derivatives] may be null.
+	auto xform_vec(int segment, const blink_Position* in, int count, blink_Position* out, float* derivatives) const -> void {
+		if (!is_ramp(segment)) {
+			for (int i = 0; i < count; i++) {
+				out[i] = xform(segment, in[i], derivatives ? &derivatives[i] : nullptr);
+			}
+			return;
+		}
+		const auto& ramp = ramps_[segment];
+		const auto x0    = points_[segment - 1].x;
+		const auto start = starts_[segment - 1];
+		if (ramp.one_minus_r == 0.0) {
+			for (int i = 0; i < count; i++) {
+				out[i] = ((in[i] - x0) * ramp.ff_min) + start;
+			}
+			if (derivatives) {
+				std::fill(derivatives, derivatives + count, float(ramp.ff_min));
+			}
+			return;
+		}
+		std::array<double, BLINK_VECTOR_SIZE> n;
+		std::array<double, BLINK_VECTOR_SIZE> rn;
+		for (int i = 0; i < count; i++) {
+			n[i] = in[i] - x0;
+			rn[i] = n[i] * ramp.log2_r;
+		}
+		simd::exp2(rn.data(), count, rn.data());
+		const auto scale = ramp.ff_min / ramp.one_minus_r;
+		for (int i = 0; i < count; i++) {
+			out[i] = ((1.0 - rn[i]) * scale) + start;
+		}
+		if (derivatives) {
+			for (int i = 0; i < count; i++) {
+				derivatives[i] = float(ramp.ff_min * rn[i]);
+			}
 		}
-		return (n * p0.ff) + segment_start_;
+	}
+	// The block position which xform() maps to [sample_position]. The
+	// mapping only ever goes up so the segment is found by a binary
+	// search on the starts.
+	[[nodiscard]] auto inverse(blink_Position sample_position) const -> blink_Position {
+		const auto segment = int(std::distance(starts_.begin(), std::upper_bound(starts_.begin(), starts_.end(), sample_position)));
+		if (segment == 0) {
+			return sample_position / points_[0].ff;
+		}
+		const auto& p0 = points_[segment - 1];
+		const auto sum = sample_position - starts_[segment - 1];
+		if (segment == int(points_.size())) {
+			return p0.x + (sum / p0.ff);
+		}
+		const auto& ramp = ramps_[segment];
+		if (ramp.one_minus_r == 0.0) {
+			return p0.x + (sum / ramp.ff_min);
+		}
+		return p0.x + sum_of_geometric_series_inverse(ramp.ff_min, ramp.r, sum);
+	}
+	[[nodiscard]] auto is_ramp(int segment) const -> bool {
+		return segment > 0 && segment < int(points_.size());
+	}
+	[[nodiscard]] auto get_ratio(int segment) const -> double { return ramps_[segment].r; }
+	[[nodiscard]] auto get_segment_x(int segment) const -> blink_Position { return points_[segment - 1].x; }
+	[[nodiscard]] auto get_points() const -> const std::vector<PitchPoint>& { return points_; }
+	[[nodiscard]] auto get_starts() const -> const std::vector<blink_Position>& { return starts_; }
+	// Changes whenever the table is rebuilt
+	[[nodiscard]] auto get_version() const -> uint64_t { return version_; }
+private:
+	struct Key {
+		uint64_t unit_state_id       = 0;
+		const blink_RealPoint* data  = nullptr;
+		size_t count                 = 0;
+		float min                    = 0.0f;
+		float max                    = 0.0f;
+		float transpose              = 0.0f;
+		auto operator==(const Key& rhs) const -> bool {
+			return unit_state_id == rhs.unit_state_id && data == rhs.data && count == rhs.count && min == rhs.min && max == rhs.max && transpose == rhs.transpose;
+		}
+	};
+	// The constants of weird_math() for the segment ending at a point,
+	// so only r^n has to be found per position
+	struct Ramp {
+		double r           = 1.0;
+		double log2_r      = 0.0;
+		double ff_min      = 1.0;
+		double one_minus_r = 0.0;
+		[[nodiscard]] auto pow(double n) const -> double {
+			return one_minus_r == 0.0 ? 1.0 : std::pow(r, n);
+		}
+		[[nodiscard]] auto sum(double rn, double n) const -> double {
+			if (one_minus_r == 0.0) {
+				return n * ff_min;
+			}
+			return ff_min * ((1.0 - rn) / one_minus_r);
+		}
+	};
+	[[nodiscard]] static auto make_ramp(const PitchPoint& p0, const PitchPoint& p1) -> Ramp {
+		const auto segment_size = p1.x - p0.x;
+		Ramp out;
+		if (segment_size > 0.0) {
+			out.log2_r      = ((double(p1.pitch) - double(p0.pitch)) / segment_size) / 12.0;
+			out.r           = std::exp2(out.log2_r);
+			out.ff_min      = math::convert::p_to_ff(double(p0.pitch));
+			out.one_minus_r = 1.0 - out.r;
+		}
+		return out;
+	}
+	Key key_;
+	uint64_t version_ = 0;
+	std::vector<PitchPoint> points_;
+	std::vector<blink_Position> starts_;
+	std::vector<Ramp> ramps_;
+};
+
+// A cursor over a PitchTable. Consecutive increasing positions are O(1)
+// and anything else is a binary search.
+//
+// Within a segment the position is a geometric series in n, so rather
+// than calling pow() for every position, r^n is stepped along by
+// multiplying by r^step. The step is nearly always the same from one
+// position to the next so r^step is cached. r^n is recalculated from
+// scratch on entering a segment, after a reset, and once per vector so
+// that rounding errors can't build up.
+struct PitchUnit {
+	blink_Position xform(const PitchTable& table, blink_Position block_position, float* derivative = nullptr) {
+		const auto segment = table.find_segment(block_position, segment_);
+		if (!table.is_ramp(segment)) {
+			segment_  = segment;
+			anchored_ = false;
+			return table.xform(segment, block_position, derivative);
+		}
+		const auto n = block_position - table.get_segment_x(segment);
+		if (segment != segment_ || !anchored_ || steps_ >= kFloatsPerDSPVector) {
+			rn_       = std::pow(table.get_ratio(segment), n);
+			step_     = 0.0;
+			r_step_   = 1.0;
+			steps_    = 0;
+			anchored_ = true;
+		}
+		else {
+			const auto step = n - n_;
+			if (step != step_) {
+				step_   = step;
+				r_step_ = std::pow(table.get_ratio(segment), step);
+			}
+			rn_ *= r_step_;
+			steps_++;
+		}
+		segment_ = segment;
+		n_       = n;
+		return table.xform_ramp(segment, n, rn_, derivative);
 	} 
+	// Moves the cursor to the segment containing the block position
+	// without transforming anything. Returns the segment.
+	auto seek(const PitchTable& table, blink_Position block_position) -> int {
+		segment_  = table.find_segment(block_position, segment_);
+		anchored_ = false;
+		return segment_;
+	}
 	void reset() {
-		segment_start_      = 0.0f;
-		point_search_index_ = 0;
+		segment_  = 0;
+		anchored_ = false;
 	} 
 private: 
-	blink_Position segment_start_ = 0.0f;
-	int point_search_index_       = 0;
+	int segment_   = 0;
+	bool anchored_ = false;
+	int steps_     = 0;
+	double n_      = 0.0;
+	double rn_     = 1.0;
+	double step_   = 0.0;
+	double r_step_ = 1.0;
 };
 
 struct Pitch {
@@ -142,29 +328,54 @@ struct Pitch {
 				const auto max = config.pitch->points.max;
 				return std::clamp(0.0f, min, max);
 			};
-			const auto ff             = math::convert::p_to_ff(get_pitch() + config.transpose);
-			*config.outputs.positions = block_positions.positions * ff;
+			const auto ff = math::convert::p_to_ff(get_pitch() + config.transpose);
+			if (block_positions.is_materialized()) {
+				*config.outputs.positions = block_positions.positions * ff;
+			}
+			else {
+				snd::frame_vec<64> positions;
+				for (int i = 0; i < count; i++) {
+					positions[i] = block_positions.ramp->at(i) * ff;
+				}
+				*config.outputs.positions = positions;
+			}
 			if (config.outputs.derivatives) {
 				*config.outputs.derivatives = ff;
 			} 
 			return;
 		} 
+		table_.update(config.unit_state_id, config.pitch, config.transpose);
 		traverser_.generate(config.unit_state_id, block_positions, count); 
 		const auto& resets = traverser_.get_resets();
-		PitchUnit::Config unit_config;
-		unit_config.transpose = config.transpose;
-		unit_config.pitch     = config.pitch;
 		config.outputs.positions->rotate_prev_pos();
+		snd::frame_vec<64> ramp_positions;
+		auto in = block_positions.positions.data();
+		if (!block_positions.is_materialized()) {
+			for (int i = 0; i < count; i++) {
+				ramp_positions[i] = block_positions.get(i);
+			}
+			in = ramp_positions.data();
+		}
+		const auto out        = config.outputs.positions->positions.data();
+		const auto [min, max] = std::minmax_element(in, in + count);
+		const auto segment    = unit_calculator_.seek(table_, *min);
+		// The whole vector can be done at once if it doesn't cross a point
+		if (table_.in_segment(segment, *min, *max)) {
+			table_.xform_vec(segment, in, count, out, config.outputs.derivatives ? config.outputs.derivatives->getBuffer() : nullptr);
+			return;
+		}
 		for (int i = 0; i < count; i++) {
 			if (resets[i] > 0) {
 				unit_calculator_.reset();
 			}
 			const auto out_derivative = config.outputs.derivatives ? &config.outputs.derivatives->getBuffer()[i] : nullptr;
-			const auto position       = unit_calculator_.xform(unit_config, block_positions.positions[i], out_derivative);
-			config.outputs.positions->positions[i] = position;
+			out[i] = unit_calculator_.xform(table_, in[i], out_derivative);
 		}
 	}
+	// Only valid after xform() has been called with a non-empty envelope
+	auto get_table() const -> const PitchTable& { return table_; }
 private:
+	PitchTable table_;
 	PitchUnit unit_calculator_;
 	Traverser traverser_;
 };
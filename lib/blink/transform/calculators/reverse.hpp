@@ -1,7 +1,11 @@
 #pragma once
 
-#include <functional>
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <vector>
 #include <snd/misc.hpp>
+#include <blink/search.hpp>
 #include "pitch.hpp"
 #include "warp.hpp"
 #include "../correction_grains.hpp"
@@ -10,207 +14,238 @@ namespace blink {
 namespace transform {
 namespace calculators {
 
-class ReverseUnit
+// The reverse points mapped into post-warp space, along with the sample
+// position each segment starts from, so that any position can be located
+// with a binary search rather than by walking every earlier reverse point.
+// Scrubbing or looping over a clip with a lot of reversals is O(log n).
+//
+// The points are mapped by a caller-supplied transform with the signature
+//
+//	blink_Position (blink_Position position, float* derivative)
+//
+// It's a template parameter rather than a std::function so that the
+// pitch/speed and warp sub-calculators it's made of can be inlined.
+//
+// Only rebuilt when the reverse points or the transform change.
+class ReverseTable
 {
 public:
 
-	struct Config
-	{
-		const blink_UniformOptionData* reversal_data;
-		std::function<blink_Position(blink_Position, float*)> transform_position;
-		CorrectionGrains* correction_grains {};
-	};
-
 	static constexpr auto MIRROR { 0 };
 	static constexpr auto TAPE { 1 };
 	static constexpr auto SLIP { 2 };
-		
-	blink_Position operator()(Config config, int buffer_index, blink_Position block_position)
+
+	// Identifies the transform into post-warp space
+	struct TransformKey
 	{
-		config_ = std::move(config);
-		const auto start_index { point_search_index_ };
+		int64_t sample_offset {};
+		float ff {}; // Pitch or speed if there is no envelope
+		uint64_t env_version {};
+		uint64_t warp_version {};
 
-		for (int i = point_search_index_; i < config.reversal_data->points.count; i++)
+		bool operator==(const TransformKey& rhs) const
 		{
-			const auto p1 { get_cache_point(1, i) };
+			return sample_offset == rhs.sample_offset && ff == rhs.ff && env_version == rhs.env_version && warp_version == rhs.warp_version;
+		}
+	};
 
-			if (block_position >= p1.x)
-			{
-				// We're past the right-hand point, so
-				// skip to the next segment
-				segment_start_frame_ = calculate_next_segment_start_frame(i);
-				point_search_index_++;
+	struct Point
+	{
+		blink_Position x;
+		int64_t y;
+		blink_Position start; // Sample position once this point has been passed
+		CorrectionGrains::Grain grain; // Emitted on arriving in the segment after this point
+	};
 
-				continue;
-			}
+	template <typename TransformFn>
+	void update(uint64_t unit_state_id, const blink_UniformOptionData* reversal_data, const TransformKey& transform_key, TransformFn&& transform_position)
+	{
+		const auto& data { reversal_data->points };
 
-			// If block position is before the first reverse
-			// point, just return the block position
-			if (i == 0)
-			{
-				return block_position;
-			}
+		if (unit_state_id == unit_state_id_ && data.data == data_ && data.count == points_.size() && transform_key == transform_key_ && !points_.empty()) return;
 
-			if (point_search_index_ != start_index)
-			{
-				// generate a correction grain
-				if (config.correction_grains)
-				{
-					generate_correction_grain(i - 1, buffer_index);
-				}
-			}
+		unit_state_id_ = unit_state_id;
+		data_ = data.data;
+		transform_key_ = transform_key;
 
-			const auto p0 { get_cache_point(0, i - 1) };
-			const auto length { p1.x - p0.x };
+		points_.resize(data.count);
 
-			if (length > 0)
-			{
-				// If we got here then we are somewhere
-				// between two reverse points
-				const auto distance { block_position - p0.x };
+		std::vector<float> ff(data.count, 1.0f);
 
-				switch (p0.y)
-				{
-					case SLIP:
-					case TAPE:
-					{
-						return segment_start_frame_ - distance;
-					}
-
-					case MIRROR:
-					{
-						return p1.x - distance;
-					}
-
-					default:
-					{
-						return segment_start_frame_ + distance;
-					}
-				}
-			}
+		for (size_t i = 0; i < data.count; i++)
+		{
+			points_[i].x = transform_position(data.data[i].x, &ff[i]);
+			points_[i].y = data.data[i].y;
 		}
 
-		if (point_search_index_ != start_index)
+		points_[0].start = points_[0].x;
+
+		for (size_t i = 1; i < points_.size(); i++)
 		{
-			// generate a correction grain
-			if (config.correction_grains)
-			{
-				generate_correction_grain(point_search_index_ - 1, buffer_index);
-			}
+			const auto& p0 { points_[i - 1] };
+			const auto distance { points_[i].x - p0.x };
+
+			points_[i].start = p0.y == TAPE ? p0.start - distance : p0.start + distance;
 		}
 
-		const auto p0 { get_cache_point(0, int(config_.reversal_data->points.count-1)) };
-		const auto distance { block_position - p0.x };
+		for (size_t i = 1; i < points_.size(); i++)
+		{
+			auto length { float(kFloatsPerDSPVector * 64) };
 
-		return segment_start_frame_ + distance;
-	}
+			if (i + 1 < points_.size())
+			{
+				const auto next_segment_length { static_cast<float>(data.data[i + 1].x - data.data[i].x) };
 
-	void reset()
-	{
-		segment_start_frame_ = 0.0f;
-		point_search_index_ = 0;
-		cache_.dirt = { -1, -1 };
-	}
+				length = std::min(length, next_segment_length * 0.75f);
+			}
 
-private:
+			points_[i].grain = { 0, points_[i - 1].y >= 0 ? -ff[i] : ff[i], length };
+		}
+	}
 
-	// Two points are kept in cache because the transformation might be expensive (?)
-	//
-	// If point_index is not equal to whatever it was the last time this point was
-	// accessed, the point is considered dirty and will update
-	//
-	blink_IntPoint get_cache_point(int cache_index, int point_index) const
+	// Returns the number of points at or to the left of the position.
+	// [hint] is a previous result. Moving forwards from it is O(1).
+	int find_segment(blink_Position position, int hint) const
 	{
-		update_cache_point(cache_index, point_index);
-
-		return cache_.points[cache_index];
+		return search::find_segment(int(points_.size()), [this](int k) { return points_[k].x; }, position, hint);
 	}
 
-	float get_cache_point_ff(int cache_index, int point_index) const
+	blink_Position xform(int segment, blink_Position position) const
 	{
-		update_cache_point(cache_index, point_index);
+		// Before the first reverse point
+		if (segment == 0) return position;
 
-		return cache_.derivatives[cache_index];
-	}
+		const auto& p0 { points_[segment - 1] };
+		const auto distance { position - p0.x };
 
-	void update_cache_point(int cache_index, int point_index) const
-	{
-		if (cache_.dirt[cache_index] != point_index)
+		// After the last one
+		if (segment == int(points_.size())) return p0.start + distance;
+
+		switch (p0.y)
 		{
-			cache_.points[cache_index] = config_.reversal_data->points.data[point_index];
-			cache_.points[cache_index].x = config_.transform_position(cache_.points[cache_index].x, &cache_.derivatives[cache_index]);
-			cache_.dirt[cache_index] = point_index;
+			case SLIP:
+			case TAPE:
+			{
+				return p0.start - distance;
+			}
+
+			case MIRROR:
+			{
+				return points_[segment].x - distance;
+			}
+
+			default:
+			{
+				return p0.start + distance;
+			}
 		}
 	}
 
-	blink_Position calculate_next_segment_start_frame(int current_search_index)
+	// The first (leftmost) position in [min, max] which xform() maps to
+	// [position], if there is one. [min] and [max] are the range of
+	// positions the earlier stages can actually reach. Reversed segments
+	// can overlap each other in any order so this has to look at every
+	// segment.
+	std::optional<blink_Position> inverse(blink_Position position, blink_Position min = -std::numeric_limits<blink_Position>::infinity(), blink_Position max = std::numeric_limits<blink_Position>::infinity()) const
 	{
-		const auto p1 { get_cache_point(1, current_search_index) };
+		const auto reachable = [min, max](blink_Position x) { return x >= min && x <= max; };
+
+		if (position < points_[0].x && reachable(position)) return position;
 
-		if (current_search_index == 0)
+		for (size_t k = 1; k < points_.size(); k++)
 		{
-			// If we got here then we are about to pass the first reverse
-			// point, in which case the segment start is the x position of
-			// the point
-			return blink_Position(p1.x);
-		}
+			const auto& p0 { points_[k - 1] };
+			const auto& p1 { points_[k] };
 
-		// If we got here then we are somewhere in between two
-		// reverse points and we are about to go to the next point
+			blink_Position distance;
 
-		// The starting frame of the next segment needs to be
-		// calculated
+			switch (p0.y)
+			{
+				case SLIP:
+				case TAPE:
+				{
+					distance = p0.start - position;
+					break;
+				}
 
-		const auto p0 { get_cache_point(0, current_search_index - 1) };
-		const auto distance { p1.x - p0.x };
+				case MIRROR:
+				{
+					distance = p1.x - position;
+					break;
+				}
 
-		switch (p0.y)
-		{
-			case TAPE:
-			{
-				return segment_start_frame_ - distance;
+				default:
+				{
+					distance = position - p0.start;
+					break;
+				}
 			}
 
-			default:
-			{
-				return segment_start_frame_ + distance;
-			}
+			if (distance >= 0.0 && distance < p1.x - p0.x && reachable(p0.x + distance)) return p0.x + distance;
 		}
+
+		const auto& last { points_.back() };
+
+		if (position >= last.start && reachable(last.x + (position - last.start))) return last.x + (position - last.start);
+
+		return std::nullopt;
 	}
 
-	void generate_correction_grain(int current_search_index, int buffer_index)
+	// The grain for arriving in [segment] from somewhere else. There is
+	// none for the first two segments.
+	bool get_grain(int segment, int buffer_index, CorrectionGrains::Grain* out) const
 	{
-		if (current_search_index < 1) return;
+		if (segment < 2) return false;
 
-		auto ff { get_cache_point_ff(1, current_search_index) };
-		const auto p0 { get_cache_point(0, current_search_index - 1) };
+		*out = points_[segment - 1].grain;
+		out->buffer_index = buffer_index;
 
-		if (p0.y >= 0) ff *= -1;
+		return true;
+	}
+
+	const std::vector<Point>& get_points() const { return points_; }
+
+private:
 
-		float length { kFloatsPerDSPVector * 64 };
+	uint64_t unit_state_id_ { 0 };
+	const blink_IntPoint* data_ { nullptr };
+	TransformKey transform_key_;
+	std::vector<Point> points_;
+};
 
-		if (current_search_index + 1 < config_.reversal_data->points.count)
+// A cursor over a ReverseTable. Consecutive increasing positions are O(1)
+// and anything else is a binary search.
+class ReverseUnit
+{
+public:
+
+	blink_Position operator()(const ReverseTable& table, CorrectionGrains* correction_grains, int buffer_index, blink_Position block_position)
+	{
+		const auto segment { table.find_segment(block_position, segment_) };
+
+		if (segment != segment_)
 		{
-			const auto p1 { config_.reversal_data->points.data[current_search_index].x };
-			const auto p2 { config_.reversal_data->points.data[current_search_index + 1].x };
-			const auto next_segment_length { static_cast<float>(p2 - p1) };
+			CorrectionGrains::Grain grain;
 
-			length = std::min(length, next_segment_length * 0.75f);
+			if (correction_grains && table.get_grain(segment, buffer_index, &grain))
+			{
+				correction_grains->push(std::move(grain));
+			}
+
+			segment_ = segment;
 		}
 
-		config_.correction_grains->push({ buffer_index, ff, length });
+		return table.xform(segment, block_position);
 	}
 
-	Config config_ {};
-	blink_Position segment_start_frame_ { 0.0f };
-	int point_search_index_ { 0 };
-
-	mutable struct
+	void reset()
 	{
-		std::array<blink_IntPoint, 2> points;
-		std::array<float, 2> derivatives;
-		std::array<int, 2> dirt { -1, -1 };
-	} cache_;
+		segment_ = 0;
+	}
+
+private:
+
+	int segment_ { 0 };
 };
 
 class Reverse
@@ -220,7 +255,7 @@ public:
 	struct Config
 	{
 		uint64_t unit_state_id;
-		std::function<blink_Position(blink_Position, float*)> transform_position;
+		ReverseTable::TransformKey transform_key;
 
 		struct
 		{
@@ -234,7 +269,25 @@ public:
 		} outputs;
 	};
 
-	void operator()(Config config, const BlockPositions& block_positions, int count)
+	template <typename TransformFn>
+	void operator()(const Config& config, TransformFn&& transform_position, const BlockPositions& block_positions, int count)
+	{
+		update_table(config, transform_position);
+
+		(*this)(config, block_positions, count);
+	}
+
+	// Brings the table up to date without transforming anything
+	template <typename TransformFn>
+	void update_table(const Config& config, TransformFn&& transform_position)
+	{
+		if (!config.option.reverse || config.option.reverse->points.count < 2) return;
+
+		table_.update(config.unit_state_id, config.option.reverse, config.transform_key, transform_position);
+	}
+
+	// Assumes the table is already up to date (see update_table())
+	void operator()(const Config& config, const BlockPositions& block_positions, int count)
 	{
 		if (config.outputs.correction_grains)
 		{
@@ -247,12 +300,6 @@ public:
 			return;
 		}
 
-		ReverseUnit::Config unit_config;
-
-		unit_config.reversal_data = config.option.reverse;
-		unit_config.transform_position = config.transform_position;
-		unit_config.correction_grains = config.outputs.correction_grains;
-
 		traverser_.generate(config.unit_state_id, block_positions, count);
 
 		const auto& resets { traverser_.get_resets() };
@@ -266,14 +313,17 @@ public:
 				unit_calculator_.reset();
 			}
 
-			const auto position { unit_calculator_(unit_config, i, block_positions.positions[i]) };
+			const auto position { unit_calculator_(table_, config.outputs.correction_grains, i, block_positions.positions[i]) };
 
 			config.outputs.positions->positions[i] = position;
 		}
 	}
 
+	const ReverseTable& get_table() const { return table_; }
+
 private:
 
+	ReverseTable table_;
 	ReverseUnit unit_calculator_;
 	Traverser traverser_;
 };
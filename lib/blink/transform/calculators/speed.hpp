@@ -1,8 +1,12 @@
 #pragma once
 
 #include "blink/data.hpp"
+#include "blink/search.hpp"
 #include "blink/traverser.hpp"
 #include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
 
 namespace blink {
 namespace transform {
@@ -12,9 +16,12 @@ template <class T> T quadratic_formula(T a, T b, T c, T n) {
 	return (a * (n * n)) + (b * n) + c;
 }
 
+// The root of the quadratic nearest zero from above, for b >= 0. Written
+// so that it doesn't lose precision when a is tiny, and still works when
+// a is zero. Rounding can take the discriminant just below zero where
+// a ramp comes to a stop at y.
 template <class T> T quadratic_formula_inverse(T a, T b, T c, T y) {
-	assert (a != T(0));
-	return (-b + std::sqrt(b * b - 4 * a * (c - y))) / (2 * a);
+	return (T(2) * (y - c)) / (b + std::sqrt(std::max(T(0), b * b - 4 * a * (c - y))));
 }
 
 template <class T> T spooky_maths(T f0, T f1, T N, T n, T C) {
@@ -30,85 +37,223 @@ template <class T> T spooky_maths(T f0, T f1, T N, T n, T C) {
 	//return quadratic_formula_inverse(accel, f0, C, n);
 //}
 
-class SpeedUnit {
-public: 
-	struct Config {
-		float speed { 0.0f };
-		const blink_UniformEnvData* env_speed { nullptr };
-	}; 
-	// We use this for both sample playback and waveform generation. This
-	// calculation needs to be fast, preferably O(n) or better.
-	//
-	// If we are calculating waveforms the start of the waveform might be
-	// millions of pixels off the left edge of the screen therefore it is
-	// not good enough to simply traverse the entire sample.
-	//
-	blink_Position operator()(Config config, blink_Position block_position, float* derivative = nullptr) {
-		struct FFPoint {
-			blink_Position x;
-			float y;
-			double ff; 
-			FFPoint(const blink_RealPoint& p, float min, float max, float speed)
-				: x(p.x)
-				, y(p.y)
-				, ff(double(std::clamp(p.y, min, max)) * speed)
-			{
+struct SpeedPoint {
+	blink_Position x;
+	float y;
+	double ff;
+};
+
+inline
+auto make_speed_point(const blink_RealPoint& p, float min, float max, float speed) {
+	SpeedPoint sp;
+	sp.x  = p.x;
+	sp.y  = p.y;
+	sp.ff = double(std::clamp(p.y, min, max)) * speed;
+	return sp;
+}
+
+// Cumulative integrals of the speed envelope at each point, so that any
+// block position can be mapped to a sample position with a binary search
+// and one closed-form evaluation, rather than by walking every earlier
+// segment. We use this for both sample playback and waveform generation,
+// and if we are calculating waveforms the start of the waveform might be
+// millions of pixels off the left edge of the screen.
+//
+// Only rebuilt when the envelope changes.
+class SpeedTable {
+public:
+	auto update(uint64_t unit_state_id, const blink_UniformEnvData* env_speed, float speed) -> void {
+		const Key key{unit_state_id, env_speed->points.data, env_speed->points.count, env_speed->points.min, env_speed->points.max, speed};
+		if (key == key_ && !points_.empty()) {
+			return;
+		}
+		key_ = key;
+		version_++;
+		points_.resize(env_speed->points.count);
+		starts_.resize(env_speed->points.count);
+		for (size_t i = 0; i < points_.size(); i++) {
+			points_[i] = make_speed_point(env_speed->points.data[i], env_speed->points.min, env_speed->points.max, speed);
+		}
+		// The sample position reached at each point. Segments where the
+		// speed is zero at both ends don't move.
+		starts_[0] = spooky_maths(points_[0].ff, points_[0].ff, 1.0, points_[0].x, 0.0);
+		for (size_t i = 1; i < points_.size(); i++) {
+			const auto& p0          = points_[i - 1];
+			const auto& p1          = points_[i];
+			const auto segment_size = p1.x - p0.x;
+			starts_[i] = starts_[i - 1];
+			if (segment_size > 0.0 && (p0.y > 0.f || p1.y > 0.f)) {
+				starts_[i] = float(spooky_maths(p0.ff, p1.ff, segment_size, segment_size, starts_[i - 1]));
 			}
-		}; 
-		for (size_t i = point_search_index_; i < config.env_speed->points.count; i++) {
-			const FFPoint p1(config.env_speed->points.data[i], config.env_speed->points.min, config.env_speed->points.max, config.speed); 
-			if (block_position < p1.x) {
-				if (i == 0) {
-					point_search_index_ = 0; 
-					if (derivative) *derivative = float(p1.ff); 
-					return spooky_maths(p1.ff, p1.ff, 1.0, block_position, double(segment_start_));
-				} 
-				FFPoint p0(config.env_speed->points.data[i - 1], config.env_speed->points.min, config.env_speed->points.max, config.speed); 
-				auto n = block_position - p0.x;
-				auto segment_size = p1.x - p0.x; 
-				if (segment_size > 0.0f) {
-					point_search_index_ = i; 
-					if (derivative) *derivative = float(std::lerp(p0.ff, p1.ff, n / segment_size)); 
-					const auto f0 = p0.ff;
-					const auto f1 = p1.ff; 
-					return spooky_maths(f0, f1, segment_size, double(n), double(segment_start_));
-				}
+		}
+	}
+	// Returns the index of the first point to the right of the block
+	// position, or the number of points if there isn't one. [hint] is a
+	// previous result. Moving forwards from it is O(1).
+	[[nodiscard]] auto find_segment(blink_Position block_position, int hint) const -> int {
+		return search::find_segment(int(points_.size()), [this](int k) { return points_[k].x; }, block_position, hint);
+	}
+	[[nodiscard]] auto xform(int segment, blink_Position block_position, float* derivative = nullptr) const -> blink_Position {
+		if (segment == 0) {
+			const auto& p1 = points_[0];
+			if (derivative) *derivative = float(p1.ff);
+			return spooky_maths(p1.ff, p1.ff, 1.0, block_position, 0.0);
+		}
+		if (segment == int(points_.size())) {
+			const auto& p0 = points_.back();
+			if (derivative) *derivative = float(p0.ff);
+			if (p0.y == 0.0f) {
+				return starts_.back();
 			}
-			else {
-				if (i == 0) {
-					point_search_index_ = 1; 
-					const auto f1 = p1.ff; 
-					segment_start_ = spooky_maths(f1, f1, 1.0, p1.x, segment_start_);
-				}
-				else {
-					point_search_index_ = i + 1; 
-					FFPoint p0(config.env_speed->points.data[i - 1], config.env_speed->points.min, config.env_speed->points.max, config.speed); 
-					auto segment_size = p1.x - p0.x; 
-					if (segment_size > 0.0f) {
-						if (p0.y > 0.f || p1.y > 0.f) {
-							auto f0 = p0.ff;
-							auto f1 = p1.ff; 
-							segment_start_ = float(spooky_maths(f0, f1, segment_size, segment_size, segment_start_));
-						}
-					}
-				}
+			return float(spooky_maths(p0.ff, p0.ff, 1.0, double(block_position - p0.x), starts_.back()));
+		}
+		const auto ramp = get_ramp(segment);
+		const auto n    = double(block_position - ramp.x);
+		if (derivative) *derivative = float(ramp.ff(n));
+		return ramp.position(n);
+	}
+	// The block position which xform() maps to [sample_position]. Only
+	// valid if the speed is never negative, in which case the mapping
+	// never goes down and the segment is found by a binary search on the
+	// starts. Where the speed is zero the first block position is used,
+	// so a run of segments which all stop at the same start goes to the
+	// first of them.
+	[[nodiscard]] auto inverse(blink_Position sample_position) const -> blink_Position {
+		const auto segment = int(std::distance(starts_.begin(), std::lower_bound(starts_.begin(), starts_.end(), sample_position)));
+		if (segment == 0) {
+			const auto& p1 = points_[0];
+			return p1.ff > 0.0 ? sample_position / p1.ff : p1.x;
+		}
+		const auto& p0 = points_[segment - 1];
+		if (segment == int(points_.size())) {
+			if (p0.y == 0.0f || p0.ff <= 0.0) {
+				return p0.x;
 			}
-		} 
-		FFPoint p0(config.env_speed->points.data[config.env_speed->points.count - 1], config.env_speed->points.min, config.env_speed->points.max, config.speed); 
-		auto n = block_position - p0.x; 
-		if (derivative) *derivative = float(p0.ff); 
-		if (p0.y == 0.0f) {
-			return segment_start_;
-		} 
-		return float(spooky_maths(p0.ff, p0.ff, 1.0, double(n), double(segment_start_)));
+			return p0.x + ((sample_position - starts_.back()) / p0.ff);
+		}
+		const auto ramp = get_ramp(segment);
+		if (sample_position <= ramp.start || (ramp.f0 <= 0.0 && ramp.accel <= 0.0)) {
+			return ramp.x;
+		}
+		return ramp.x + quadratic_formula_inverse(ramp.accel, ramp.f0, ramp.start, sample_position);
+	}
+	// The lowest and highest sample positions xform() can reach. The
+	// speed can be zero before the first point or after the last one.
+	[[nodiscard]] auto get_range() const -> std::pair<blink_Position, blink_Position> {
+		constexpr auto inf = std::numeric_limits<blink_Position>::infinity();
+		const auto& first  = points_.front();
+		const auto& last   = points_.back();
+		return {first.ff > 0.0 ? -inf : 0.0, last.y == 0.0f || last.ff <= 0.0 ? starts_.back() : inf};
+	}
+	// The quadratic for a segment strictly between two points, in terms of
+	// the distance from the first one
+	struct Ramp {
+		blink_Position x;
+		double f0;
+		double f1;
+		double size;
+		double accel;
+		blink_Position start;
+		[[nodiscard]] auto position(double n) const -> blink_Position { return quadratic_formula(accel, f0, start, n); }
+		[[nodiscard]] auto ff(double n) const -> double { return f0 + ((f1 - f0) * (n / size)); }
+	};
+	[[nodiscard]] auto is_ramp(int segment) const -> bool {
+		return segment > 0 && segment < int(points_.size());
+	}
+	[[nodiscard]] auto get_ramp(int segment) const -> Ramp {
+		const auto& p0 = points_[segment - 1];
+		const auto& p1 = points_[segment];
+		const auto size = p1.x - p0.x;
+		return {p0.x, p0.ff, p1.ff, size, (p1.ff - p0.ff) / (2.0 * size), starts_[segment - 1]};
+	}
+	[[nodiscard]] auto in_segment(int segment, blink_Position min, blink_Position max) const -> bool {
+		return search::in_segment(int(points_.size()), [this](int k) { return points_[k].x; }, segment, min, max);
+	}
+	[[nodiscard]] auto get_points() const -> const std::vector<SpeedPoint>& { return points_; }
+	[[nodiscard]] auto get_starts() const -> const std::vector<blink_Position>& { return starts_; }
+	// Changes whenever the table is rebuilt
+	[[nodiscard]] auto get_version() const -> uint64_t { return version_; }
+private:
+	struct Key {
+		uint64_t unit_state_id       = 0;
+		const blink_RealPoint* data  = nullptr;
+		size_t count                 = 0;
+		float min                    = 0.0f;
+		float max                    = 0.0f;
+		float speed                  = 0.0f;
+		auto operator==(const Key& rhs) const -> bool {
+			return unit_state_id == rhs.unit_state_id && data == rhs.data && count == rhs.count && min == rhs.min && max == rhs.max && speed == rhs.speed;
+		}
+	};
+	Key key_;
+	uint64_t version_ = 0;
+	std::vector<SpeedPoint> points_;
+	std::vector<blink_Position> starts_;
+};
+
+// A cursor over a SpeedTable. Consecutive increasing positions are O(1)
+// and anything else is a binary search.
+//
+// Within a segment the position is a quadratic in n, so while the step
+// between positions stays the same the position and derivative are
+// advanced by forward differences (three adds) instead of being
+// evaluated from scratch. They are evaluated from scratch on entering a
+// segment, after a reset, when the step changes, and once per vector so
+// that rounding errors can't build up.
+class SpeedUnit {
+public: 
+	blink_Position operator()(const SpeedTable& table, blink_Position block_position, float* derivative = nullptr) {
+		const auto segment = table.find_segment(block_position, segment_);
+		if (!table.is_ramp(segment)) {
+			segment_  = segment;
+			anchored_ = false;
+			return table.xform(segment, block_position, derivative);
+		}
+		const auto n       = double(block_position - table.get_points()[segment - 1].x);
+		const auto stepped = segment == segment_ && anchored_;
+		if (stepped && n - n_ == step_ && steps_ < kFloatsPerDSPVector) {
+			position_ += delta_;
+			delta_    += delta2_;
+			ff_       += delta_ff_;
+			steps_++;
+		}
+		else {
+			const auto ramp = table.get_ramp(segment);
+			position_ = ramp.position(n);
+			ff_       = ramp.ff(n);
+			step_     = stepped ? n - n_ : step_;
+			delta_    = (ramp.accel * ((2.0 * n * step_) + (step_ * step_))) + (ramp.f0 * step_);
+			delta2_   = 2.0 * ramp.accel * step_ * step_;
+			delta_ff_ = (ramp.f1 - ramp.f0) * step_ / ramp.size;
+			steps_    = 0;
+			anchored_ = true;
+		}
+		segment_ = segment;
+		n_       = n;
+		if (derivative) *derivative = float(ff_);
+		return position_;
+	}
+	// Finds the segment without transforming anything
+	int seek(const SpeedTable& table, blink_Position block_position) {
+		segment_  = table.find_segment(block_position, segment_);
+		anchored_ = false;
+		return segment_;
 	}
 	void reset() {
-		segment_start_      = 0.0;
-		point_search_index_ = 0;
+		segment_  = 0;
+		anchored_ = false;
 	} 
 private: 
-	blink_Position segment_start_ = 0.0;
-	size_t point_search_index_    = 0;
+	int segment_     = 0;
+	bool anchored_   = false;
+	int steps_       = 0;
+	double n_        = 0.0;
+	double step_     = 1.0;
+	blink_Position position_ = 0.0;
+	double delta_    = 0.0;
+	double delta2_   = 0.0;
+	double ff_       = 0.0;
+	double delta_ff_ = 0.0;
 };
 
 class Speed {
@@ -124,35 +269,83 @@ public:
 	}; 
 	void operator()(Config config, const BlockPositions& block_positions, int count) {
 		if (!config.env_speed || config.env_speed->points.count < 1) {
-			const auto get_env_speed { [&config]() {
-				if (!config.env_speed) return 0.0f; 
-				const auto min { config.env_speed->points.min };
-				const auto max { config.env_speed->points.max }; 
-				return std::clamp(1.0f, min, max);
-			}}; 
-			const auto ff { get_env_speed() * config.speed }; 
-			*config.outputs.positions = block_positions.positions * ff; 
+			const auto ff { get_flat_ff(config) }; 
+			if (block_positions.is_materialized()) {
+				*config.outputs.positions = block_positions.positions * ff; 
+			}
+			else {
+				snd::frame_vec<64> positions;
+				for (int i = 0; i < count; i++) {
+					positions[i] = block_positions.ramp->at(i) * ff;
+				}
+				*config.outputs.positions = positions;
+			}
 			if (config.outputs.derivatives) {
 				*config.outputs.derivatives = ff;
 			} 
 			return;
 		} 
+		table_.update(config.unit_state_id, config.env_speed, config.speed);
 		traverser_.generate(config.unit_state_id, block_positions, count); 
 		const auto& resets { traverser_.get_resets() }; 
-		SpeedUnit::Config unit_config; 
-		unit_config.speed = config.speed;
-		unit_config.env_speed = config.env_speed; 
 		config.outputs.positions->rotate_prev_pos(); 
+		auto min { block_positions.positions[0] };
+		auto max { block_positions.positions[0] };
+		for (int i = 1; i < count; i++) {
+			min = std::min(min, block_positions.positions[i]);
+			max = std::max(max, block_positions.positions[i]);
+		}
+		const auto k { unit_calculator_.seek(table_, min) };
+		// Usually the whole vector falls in one segment, in which case the
+		// lanes don't depend on each other
+		if (table_.in_segment(k, min, max)) {
+			if (table_.is_ramp(k)) {
+				const auto ramp { table_.get_ramp(k) };
+				for (int i = 0; i < count; i++) {
+					config.outputs.positions->positions[i] = ramp.position(double(block_positions.positions[i] - ramp.x));
+				}
+				if (config.outputs.derivatives) {
+					for (int i = 0; i < count; i++) {
+						config.outputs.derivatives->getBuffer()[i] = float(ramp.ff(double(block_positions.positions[i] - ramp.x)));
+					}
+				}
+				return;
+			}
+			// Before the first point or after the last one
+			for (int i = 0; i < count; i++) {
+				const auto out_derivative { config.outputs.derivatives ? &config.outputs.derivatives->getBuffer()[i] : nullptr };
+				config.outputs.positions->positions[i] = table_.xform(k, block_positions.positions[i], out_derivative);
+			}
+			return;
+		}
 		for (int i = 0; i < count; i++) {
 			if (resets[i] > 0) {
 				unit_calculator_.reset();
 			} 
 			const auto out_derivative { config.outputs.derivatives ? &config.outputs.derivatives->getBuffer()[i] : nullptr };
-			const auto position { unit_calculator_( unit_config, block_positions.positions[i], out_derivative) }; 
+			const auto position { unit_calculator_(table_, block_positions.positions[i], out_derivative) }; 
 			config.outputs.positions->positions[i] = position;
 		}
 	} 
+	// The speed when there is no envelope
+	static auto get_flat_ff(const Config& config) -> float {
+		const auto get_env_speed { [&config]() {
+			if (!config.env_speed) return 0.0f; 
+			const auto min { config.env_speed->points.min };
+			const auto max { config.env_speed->points.max }; 
+			return std::clamp(1.0f, min, max);
+		}}; 
+		return get_env_speed() * config.speed;
+	}
+	// Brings the table up to date without transforming anything
+	auto update_table(const Config& config) -> void {
+		if (!config.env_speed || config.env_speed->points.count < 1) return;
+		table_.update(config.unit_state_id, config.env_speed, config.speed);
+	}
+	// Only valid after being called with a non-empty envelope
+	auto get_table() const -> const SpeedTable& { return table_; }
 private: 
+	SpeedTable table_;
 	SpeedUnit unit_calculator_;
 	Traverser traverser_;
 };
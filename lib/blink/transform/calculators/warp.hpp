@@ -1,85 +1,152 @@
 #pragma once 
 
+#include "blink/search.hpp"
 #include "blink/traverser.hpp"
+#include <algorithm>
+#include <vector>
 
 namespace blink {
 namespace transform {
 namespace calculators {
 
-class WarpUnit
+// Warp maps are piecewise linear so they are compiled into a slope and
+// intercept per segment. Segment k covers [points[k-1].y, points[k].y).
+// Before the first point and after the last one positions pass through
+// with a slope of 1.
+//
+// Only rebuilt when the warp points change.
+class WarpTable
 {
 public:
 
-	blink_Position operator()(const blink_WarpPoints* warp_points, blink_Position position, float* derivative = nullptr)
+	struct Segment
 	{
-		if (warp_points->count == 1)
-		{
-			if (derivative) *derivative = 1.0f;
+		double slope;
+		double intercept;
+		float derivative;
+	};
+
+	void update(uint64_t unit_state_id, const blink_WarpPoints* warp_points)
+	{
+		if (unit_state_id == unit_state_id_ && warp_points->points == points_ && warp_points->count == breakpoints_.size() && !segments_.empty()) return;
+
+		unit_state_id_ = unit_state_id;
+		points_ = warp_points->points;
+		version_++;
+
+		const auto count { warp_points->count };
+
+		breakpoints_.resize(count);
+		targets_.resize(count);
+		segments_.resize(count + 1);
 
-			return position - blink_Position(warp_points->points[0].y - warp_points->points[0].x);
+		for (size_t i = 0; i < count; i++)
+		{
+			breakpoints_[i] = blink_Position(warp_points->points[i].y);
+			targets_[i] = blink_Position(warp_points->points[i].x);
 		}
 
-		for (int i = point_search_index_; i < warp_points->count; i++)
+		const auto& first { warp_points->points[0] };
+		const auto& last { warp_points->points[count - 1] };
+
+		segments_[0] = { 1.0, double(first.x - first.y), 1.0f };
+		segments_[count] = { 1.0, double(last.x - last.y), 1.0f };
+
+		for (size_t k = 1; k < count; k++)
 		{
-			point_search_index_ = i;
+			const auto& p0 { warp_points->points[k - 1] };
+			const auto& p1 { warp_points->points[k] };
 
-			auto p1 { warp_points->points[i] };
+			const auto x_diff { p1.x - p0.x };
+			const auto y_diff { p1.y - p0.y };
 
-			if (position < p1.y)
+			if (y_diff <= 0)
 			{
-				if (i == 0)
-				{
-					auto x { position / p1.y };
-
-					if (derivative) *derivative = 1.0f;
-
-					return p1.x + (position - p1.y);
-				}
-
-				auto p0 { warp_points->points[i - 1] };
-				auto segment_size { p1.y - p0.y };
-
-				if (segment_size > 0.f)
-				{
-					auto x { (position - p0.y) / segment_size };
-
-					if (derivative)
-					{
-						const auto x_diff { (p1.x - p0.x) };
-						const auto y_diff { (p1.y - p0.y) };
-
-						if (y_diff == 0.0f)
-						{
-							*derivative = 0.0f;
-						}
-						else
-						{
-							*derivative = static_cast<float>(x_diff) / static_cast<float>(y_diff);
-						}
-					}
-
-					return std::lerp(float(p0.x), float(p1.x), float(x));
-				}
+				// Empty segment, can never be hit
+				segments_[k] = { 0.0, double(p0.x), 0.0f };
+				continue;
 			}
+
+			const auto slope { double(x_diff) / double(y_diff) };
+
+			segments_[k] = { slope, double(p0.x) - (slope * double(p0.y)), static_cast<float>(x_diff) / static_cast<float>(y_diff) };
 		}
+	}
+
+	// Returns the index of the first point to the right of the position,
+	// or the number of points if there isn't one. [hint] is a previous
+	// result. Moving forwards from it is O(1).
+	int find_segment(blink_Position position, int hint) const
+	{
+		return search::find_segment(int(breakpoints_.size()), [this](int k) { return breakpoints_[k]; }, position, hint);
+	}
+
+	bool in_segment(int k, blink_Position min, blink_Position max) const
+	{
+		return search::in_segment(int(breakpoints_.size()), [this](int i) { return breakpoints_[i]; }, k, min, max);
+	}
+
+	const Segment& get_segment(int k) const { return segments_[k]; }
+
+	// Changes whenever the table is rebuilt
+	uint64_t get_version() const { return version_; }
+
+	blink_Position xform(int k, blink_Position position, float* derivative = nullptr) const
+	{
+		const auto& segment { segments_[k] };
+
+		if (derivative) *derivative = segment.derivative;
+
+		return (segment.slope * position) + segment.intercept;
+	}
+
+	// The position which xform() maps to [position]. Assumes the warp
+	// points go up in x as well as in y.
+	blink_Position inverse(blink_Position position) const
+	{
+		const auto k { int(std::distance(targets_.begin(), std::upper_bound(targets_.begin(), targets_.end(), position))) };
+		const auto& segment { segments_[k] };
+
+		// Nothing is mapped into an empty segment
+		if (segment.slope == 0.0) return breakpoints_[k - 1];
 
-		auto p0 { warp_points->points[warp_points->count - 1] };
+		return (position - segment.intercept) / segment.slope;
+	}
+
+private:
 
-		point_search_index_ = int(warp_points->count);
+	uint64_t unit_state_id_ { 0 };
+	uint64_t version_ { 0 };
+	const blink_WarpPoint* points_ { nullptr };
+	std::vector<blink_Position> breakpoints_;
+	std::vector<blink_Position> targets_;
+	std::vector<Segment> segments_;
+};
 
-		if (derivative) *derivative = 1.0f;
+// A cursor over a WarpTable. Consecutive increasing positions are O(1)
+// and anything else is a binary search.
+class WarpUnit
+{
+public:
 
-		return p0.x + (position - p0.y);
+	blink_Position operator()(const WarpTable& table, blink_Position position, float* derivative = nullptr)
+	{
+		return table.xform(seek(table, position), position, derivative);
+	}
+
+	int seek(const WarpTable& table, blink_Position position)
+	{
+		return segment_ = table.find_segment(position, segment_);
 	}
 
 	void reset()
 	{
-		point_search_index_ = 0;
+		segment_ = 0;
 	}
 
 private:
 
-	int point_search_index_ { 0 };
+	int segment_ { 0 };
 };
 
 class Warp
@@ -109,30 +176,60 @@ public:
 			return;
 		}
 
-		traverser_.generate(config.unit_state_id, block_positions, count);
-
-		const auto& resets { traverser_.get_resets() };
+		table_.update(config.unit_state_id, config.warp_points);
 
 		config.outputs.positions->rotate_prev_pos();
 
-		for (int i = 0; i < count; i++)
+		auto min { block_positions.positions[0] };
+		auto max { block_positions.positions[0] };
+
+		for (int i = 1; i < count; i++)
+		{
+			min = std::min(min, block_positions.positions[i]);
+			max = std::max(max, block_positions.positions[i]);
+		}
+
+		const auto k { unit_calculator_.seek(table_, block_positions.positions[0]) };
+
+		// Usually the whole vector falls in one segment
+		if (table_.in_segment(k, min, max))
 		{
-			if (resets[i] > 0)
+			const auto& segment { table_.get_segment(k) };
+
+			for (int i = 0; i < count; i++)
 			{
-				unit_calculator_.reset();
+				config.outputs.positions->positions[i] = (segment.slope * block_positions.positions[i]) + segment.intercept;
 			}
 
+			if (config.outputs.derivatives) *config.outputs.derivatives = segment.derivative;
+
+			return;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
 			const auto out_derivative { config.outputs.derivatives ? &config.outputs.derivatives->getBuffer()[i] : nullptr };
-			const auto position { unit_calculator_(config.warp_points, block_positions.positions[i], out_derivative) };
+			const auto position { unit_calculator_(table_, block_positions.positions[i], out_derivative) };
 
 			config.outputs.positions->positions[i] = position;
 		}
 	}
 
+	// Brings the table up to date without transforming anything
+	void update_table(const Config& config)
+	{
+		if (!config.warp_points || config.warp_points->count < 1) return;
+
+		table_.update(config.unit_state_id, config.warp_points);
+	}
+
+	// Only valid after being called with at least one warp point
+	const WarpTable& get_table() const { return table_; }
+
 private:
 
+	WarpTable table_;
 	WarpUnit unit_calculator_;
-	Traverser traverser_;
 };
 
 } // calculators
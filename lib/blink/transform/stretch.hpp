@@ -5,6 +5,7 @@
 #include "calculators/speed.hpp"
 #include "calculators/reverse.hpp"
 #include "calculators/warp.hpp"
+#include <optional>
 
 namespace blink {
 namespace transform {
@@ -42,6 +43,10 @@ public:
 	};
 	
 	void operator()(Config config, const BlockPositions& block_positions, int count);
+	std::optional<blink_Position> inverse(Config config, blink_Position sample_position);
+
+	// Only does any work for the tables whose inputs have changed
+	void update_tables(const Config& config);
 
 	auto& get_sped_positions() const { return stage_.positions.sped; }
 	auto& get_warped_positions() const { return stage_.positions.warped; }
@@ -51,6 +56,10 @@ public:
 
 private:
 
+	calculators::Speed::Config get_speed_config(const Config& config);
+	calculators::Warp::Config get_warp_config(const Config& config);
+	calculators::Reverse::Config get_reverse_config(const Config& config);
+	void update_reverse_table(const Config& config);
 	void apply_speed(const Config& config, const BlockPositions& block_positions, int count);
 	void apply_sample_offset(const Config& config);
 	void apply_warp(const Config& config, int count);
@@ -72,6 +81,8 @@ private:
 		} derivatives;
 	} stage_;
 
+	BlockPositions input_;
+
 	struct
 	{
 		calculators::Speed speed;
@@ -82,13 +93,98 @@ private:
 
 inline void Stretch::operator()(Config config, const BlockPositions& block_positions, int count)
 {
-	apply_speed(config, block_positions, count);
+	// A ramp can go straight through a flat speed. Otherwise the speed
+	// calculator needs the actual positions.
+	if (!block_positions.is_materialized() && config.env.speed && config.env.speed->points.count > 0)
+	{
+		input_ = block_positions;
+		input_.materialize();
+
+		apply_speed(config, input_, count);
+	}
+	else
+	{
+		apply_speed(config, block_positions, count);
+	}
+
 	apply_sample_offset(config);
 	apply_warp(config, count);
 	apply_reverse(config, count);
 }
 
-inline void Stretch::apply_speed(const Config& config, const BlockPositions& block_positions, int count)
+// Runs every stage backwards, from a final sample position to a block
+// position. Where reversal means the sample position is reached more
+// than once, the leftmost block position is returned. Returns nothing if
+// it is never reached. Only valid if the speed envelope is never
+// negative.
+inline std::optional<blink_Position> Stretch::inverse(Config config, blink_Position sample_position)
+{
+	update_tables(config);
+
+	const auto has_speed { config.env.speed && config.env.speed->points.count > 0 };
+	const auto has_warp { config.warp_points && config.warp_points->count > 0 };
+	const auto has_reverse { config.option.reverse && config.option.reverse->points.count > 1 };
+
+	auto x { sample_position };
+
+	if (has_reverse)
+	{
+		// Where the speed is zero, some post-warp positions are never
+		// reached and mustn't be picked
+		auto min { -std::numeric_limits<blink_Position>::infinity() };
+		auto max { std::numeric_limits<blink_Position>::infinity() };
+
+		if (has_speed)
+		{
+			const auto range { calculators_.speed.get_table().get_range() };
+
+			min = range.first - config.sample_offset;
+			max = range.second - config.sample_offset;
+
+			if (has_warp)
+			{
+				min = calculators_.warp.get_table().xform(calculators_.warp.get_table().find_segment(min, 0), min);
+				max = calculators_.warp.get_table().xform(calculators_.warp.get_table().find_segment(max, 0), max);
+			}
+		}
+
+		const auto unreversed { calculators_.reverse.get_table().inverse(x, min, max) };
+
+		if (!unreversed) return std::nullopt;
+
+		x = *unreversed;
+	}
+
+	if (has_warp)
+	{
+		x = calculators_.warp.get_table().inverse(x);
+	}
+
+	x += config.sample_offset;
+
+	if (has_speed)
+	{
+		return calculators_.speed.get_table().inverse(x);
+	}
+
+	const auto ff { calculators::Speed::get_flat_ff(get_speed_config(config)) };
+
+	if (ff == 0.0f) return std::nullopt;
+
+	return x / ff;
+}
+
+inline void Stretch::update_tables(const Config& config)
+{
+	calculators_.speed.update_table(get_speed_config(config));
+	calculators_.warp.update_table(get_warp_config(config));
+
+	// The reverse points are mapped through the other two tables so they
+	// go last
+	update_reverse_table(config);
+}
+
+inline calculators::Speed::Config Stretch::get_speed_config(const Config& config)
 {
 	calculators::Speed::Config calculator_config;
 
@@ -98,7 +194,12 @@ inline void Stretch::apply_speed(const Config& config, const BlockPositions& blo
 	calculator_config.outputs.positions = &stage_.positions.sped;
 	calculator_config.outputs.derivatives = config.outputs.derivatives.sped ? &stage_.derivatives.sped : nullptr;
 
-	calculators_.speed(calculator_config, block_positions, count);
+	return calculator_config;
+}
+
+inline void Stretch::apply_speed(const Config& config, const BlockPositions& block_positions, int count)
+{
+	calculators_.speed(get_speed_config(config), block_positions, count);
 }
 
 inline void Stretch::apply_sample_offset(const Config& config)
@@ -106,7 +207,7 @@ inline void Stretch::apply_sample_offset(const Config& config)
 	stage_.positions.sped.positions -= config.sample_offset;
 }
 
-inline void Stretch::apply_warp(const Config& config, int count)
+inline calculators::Warp::Config Stretch::get_warp_config(const Config& config)
 {
 	calculators::Warp::Config calculator_config;
 
@@ -115,10 +216,35 @@ inline void Stretch::apply_warp(const Config& config, int count)
 	calculator_config.outputs.positions = &stage_.positions.warped;
 	calculator_config.outputs.derivatives = config.outputs.derivatives.warped ? &stage_.derivatives.warped : nullptr;
 
-	calculators_.warp(calculator_config, stage_.positions.sped, count);
+	return calculator_config;
 }
 
-inline void Stretch::apply_reverse(const Config& config, int count)
+inline void Stretch::apply_warp(const Config& config, int count)
+{
+	calculators_.warp(get_warp_config(config), stage_.positions.sped, count);
+}
+
+inline calculators::Reverse::Config Stretch::get_reverse_config(const Config& config)
+{
+	const auto has_speed { config.env.speed && config.env.speed->points.count > 0 };
+	const auto has_warp { config.warp_points && config.warp_points->count > 0 };
+
+	calculators::Reverse::Config calculator_config;
+
+	calculator_config.option.reverse = config.option.reverse;
+	calculator_config.outputs.positions = &stage_.positions.reversed;
+	calculator_config.unit_state_id = config.unit_state_id;
+	calculator_config.transform_key.sample_offset = config.sample_offset;
+	calculator_config.transform_key.ff = has_speed ? 0.0f : config.speed;
+	calculator_config.transform_key.env_version = has_speed ? calculators_.speed.get_table().get_version() : 0;
+	calculator_config.transform_key.warp_version = has_warp ? calculators_.warp.get_table().get_version() : 0;
+
+	return calculator_config;
+}
+
+// Maps the reverse points into post-warp space. The speed and warp tables
+// must already be up to date.
+inline void Stretch::update_reverse_table(const Config& config)
 {
 	// These sub-calculators are used to transform reverse
 	// modulation points into "post-warp-space" by applying
@@ -126,7 +252,6 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 	struct
 	{
 		calculators::SpeedUnit speed;
-		calculators::SpeedUnit::Config speed_config {};
 		calculators::WarpUnit warp;
 
 		struct
@@ -136,14 +261,19 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 		} prev_positions;
 	} sub_calculators;
 
-	sub_calculators.speed_config.env_speed = config.env.speed;
-	sub_calculators.speed_config.speed = config.speed;
+	// The speed and warp calculators have already built these for the
+	// current envelope and warp points
+	const auto& speed_table { calculators_.speed.get_table() };
+	const auto& warp_table { calculators_.warp.get_table() };
 
-	const auto transform_position { [&sub_calculators, &config](blink_Position p, float* derivative)
+	const auto has_speed { config.env.speed && config.env.speed->points.count > 0 };
+	const auto has_warp { config.warp_points && config.warp_points->count > 0 };
+
+	const auto transform_position { [&sub_calculators, &config, &speed_table, &warp_table, has_speed, has_warp](blink_Position p, float* derivative)
 	{
 		auto x { static_cast<blink_Position>(p) };
 
-		if (config.env.speed && config.env.speed->points.count > 0)
+		if (has_speed)
 		{
 			if (x < sub_calculators.prev_positions.pre_speed)
 			{
@@ -152,7 +282,7 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 
 			sub_calculators.prev_positions.pre_speed = x;
 
-			x = sub_calculators.speed(sub_calculators.speed_config, x);
+			x = sub_calculators.speed(speed_table, x);
 		}
 		else
 		{
@@ -161,7 +291,7 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 
 		x -= config.sample_offset;
 
-		if (config.warp_points && config.warp_points->count > 0)
+		if (has_warp)
 		{
 			if (x < sub_calculators.prev_positions.pre_warp)
 			{
@@ -170,7 +300,7 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 
 			sub_calculators.prev_positions.pre_warp = x;
 
-			x = sub_calculators.warp(config.warp_points, x);
+			x = sub_calculators.warp(warp_table, x);
 		}
 
 		p = static_cast<blink_Position>(x);
@@ -178,14 +308,14 @@ inline void Stretch::apply_reverse(const Config& config, int count)
 		return p;
 	}};
 
-	calculators::Reverse::Config calculator_config;
+	calculators_.reverse.update_table(get_reverse_config(config), transform_position);
+}
 
-	calculator_config.option.reverse = config.option.reverse;
-	calculator_config.outputs.positions = &stage_.positions.reversed;
-	calculator_config.unit_state_id = config.unit_state_id;
-	calculator_config.transform_position = transform_position;
+inline void Stretch::apply_reverse(const Config& config, int count)
+{
+	update_reverse_table(config);
 
-	calculators_.reverse(calculator_config, stage_.positions.warped, count);
+	calculators_.reverse(get_reverse_config(config), stage_.positions.warped, count);
 }
 
 } // transform
@@ -6,12 +6,34 @@
 #include "calculators/warp.hpp"
 #include "correction_grains.hpp"
 #include "blink/traverser.hpp"
+#include <optional>
 #include <snd/frame-pos.hpp>
 
 namespace blink {
 namespace transform {
 
+// All of the stages are evaluated in a single pass over the positions,
+// carrying each lane through pitch, sample offset, warp and reverse. The
+// pitch and warp mappings are monotonic, so a backwards jump in the block
+// positions is a backwards jump at every stage, and one reset mask is
+// shared by all of them.
+//
+// The final positions are always written. The intermediate stages are
+// only written if the caller asks for them.
+//
+// If the block positions are a ramp and no stage crosses a breakpoint,
+// only the first and last lanes are transformed and the rest are filled
+// in between them. Otherwise, if no pitch point is crossed, the pitch
+// stage is evaluated for the whole vector at once.
 struct Tape {
+	// Everything which only depends on the config. Can be built once and
+	// shared by any number of Tapes, e.g. to draw in parallel (see
+	// draw::tape().)
+	struct Tables {
+		calculators::PitchTable pitch;
+		calculators::WarpTable warp;
+		calculators::ReverseTable reverse;
+	};
 	struct Config {
 		uint64_t unit_state_id;
 		float transpose {};
@@ -29,10 +51,26 @@ struct Tape {
 				bool pitch {};
 				bool warped {};
 			} derivatives; 
+			struct {
+				bool pitched { true };
+				bool warped { true };
+			} positions;
 			bool correction_grains {};
 		} outputs;
 	}; 
+	Tape() = default;
+	// Reads [shared_tables] instead of building its own. They must already
+	// be up to date for the config passed to xform() (see update_tables())
+	// and must outlive the Tape.
+	explicit Tape(const Tables* shared_tables) : shared_tables_{shared_tables} {}
+	// Only does any work for the tables whose inputs have changed
+	static auto update_tables(const Config& config, Tables* tables) -> void;
 	void xform(Config config, const BlockPositions& block_positions, int count); 
+	[[nodiscard]] auto inverse(Config config, blink_Position sample_position) -> std::optional<blink_Position>;
+	// True if no stage crosses a breakpoint in between the block positions
+	// x0 and x1, so each stage is a single smooth curve over that range.
+	// Only valid after xform() has been called with the same config.
+	[[nodiscard]] auto is_smooth(const Config& config, blink_Position x0, blink_Position x1) const -> bool;
 	auto& get_pitched_positions() const { return stage_.positions.pitched; }
 	auto& get_warped_positions() const { return stage_.positions.warped; }
 	auto& get_reversed_positions() const { return stage_.positions.reversed; }
@@ -40,10 +78,23 @@ struct Tape {
 	auto& get_warped_derivatives() const { return stage_.derivatives.warped; }
 	auto& get_correction_grains() const { return stage_.correction_grains; } 
 private: 
-	void apply_pitch(const Config& config, const BlockPositions& block_positions, int count);
-	void apply_sample_offset(const Config& config);
-	void apply_warp(const Config& config, int count);
-	void apply_reverse(const Config& config, int count); 
+	[[nodiscard]] static auto get_flat_pitch_ff(const Config& config) -> float;
+	static auto update_reverse_table(const Config& config, bool has_pitch, bool has_warp, Tables* tables) -> void;
+	struct Stages {
+		bool pitch;
+		bool warp;
+		bool reverse;
+		float flat_ff;
+	};
+	[[nodiscard]] static auto get_stages(const Config& config) -> Stages;
+	static auto update_tables(const Config& config, const Stages& stages, Tables* tables) -> void;
+	[[nodiscard]] auto get_tables() const -> const Tables& { return shared_tables_ ? *shared_tables_ : tables_; }
+	struct Lane {
+		blink_Position pitched;
+		blink_Position warped;
+		blink_Position reversed;
+	};
+	[[nodiscard]] auto get_end(const Config& config, const Stages& stages, blink_Position x0, blink_Position x1, bool linear, Lane* end) const -> bool;
 	struct {
 		struct {
 			BlockPositions pitched;
@@ -56,65 +107,49 @@ private:
 		} derivatives; 
 		CorrectionGrains correction_grains;
 	} stage_; 
+	Tables tables_;
+	const Tables* shared_tables_ = nullptr;
+	// The cursors
 	struct {
-		calculators::Pitch pitch;
-		calculators::Warp warp;
-		calculators::Reverse reverse;
+		calculators::PitchUnit pitch;
+		calculators::WarpUnit warp;
+		calculators::ReverseUnit reverse;
 	} calculators_;
+	Traverser traverser_;
 };
 
-inline void Tape::xform(Config config, const BlockPositions& block_positions, int count) {
-	apply_pitch(config, block_positions, count);
-	apply_sample_offset(config);
-	apply_warp(config, count);
-	apply_reverse(config, count);
-}
-
-inline void Tape::apply_pitch(const Config& config, const BlockPositions& block_positions, int count) {
-	calculators::Pitch::Config calculator_config; 
-	calculator_config.unit_state_id = config.unit_state_id;
-	calculator_config.transpose = config.transpose;
-	calculator_config.pitch = config.env.pitch;
-	calculator_config.outputs.positions = &stage_.positions.pitched;
-	calculator_config.outputs.derivatives = config.outputs.derivatives.pitch ? &stage_.derivatives.pitched : nullptr; 
-	calculators_.pitch.xform(calculator_config, block_positions, count);
-}
-
-inline void Tape::apply_sample_offset(const Config& config) {
-	stage_.positions.pitched.positions -= config.sample_offset;
-}
-
-inline void Tape::apply_warp(const Config& config, int count) {
-	calculators::Warp::Config calculator_config; 
-	calculator_config.unit_state_id = config.unit_state_id;
-	calculator_config.warp_points = config.warp_points;
-	calculator_config.outputs.positions = &stage_.positions.warped;
-	calculator_config.outputs.derivatives = config.outputs.derivatives.warped ? &stage_.derivatives.warped : nullptr; 
-	calculators_.warp(calculator_config, stage_.positions.pitched, count);
+// The pitch when there is no envelope
+inline auto Tape::get_flat_pitch_ff(const Config& config) -> float {
+	const auto get_pitch = [&config]() {
+		if (!config.env.pitch) {
+			return 0.0f; 
+		}
+		return std::clamp(0.0f, config.env.pitch->points.min, config.env.pitch->points.max);
+	};
+	return math::convert::p_to_ff(get_pitch() + config.transpose);
 }
 
-inline void Tape::apply_reverse(const Config& config, int count) {
+// Maps the reverse points into post-warp space. Only does any work if
+// the reverse points, pitch, offset or warp have changed.
+inline auto Tape::update_reverse_table(const Config& config, bool has_pitch, bool has_warp, Tables* tables) -> void {
 	// These sub-calculators are used to transform reverse
 	// modulation points into "post-warp-space" by applying
 	// the pitch and warp calculations to each point
 	struct {
 		calculators::PitchUnit pitch;
-		calculators::PitchUnit::Config pitch_config {};
 		calculators::WarpUnit warp; 
 		struct {
 			blink_Position pre_pitch { std::numeric_limits<std::int32_t>::max() };
 			blink_Position pre_warp { std::numeric_limits<std::int32_t>::max() };
 		} prev_positions;
 	} sub_calculators;
-
-	sub_calculators.pitch_config.pitch = config.env.pitch;
-	sub_calculators.pitch_config.transpose = config.transpose;
-
-	const auto transform_position { [&sub_calculators, &config](blink_Position p, float* derivative)
+	const auto& pitch_table = tables->pitch;
+	const auto& warp_table  = tables->warp;
+	const auto transform_position { [&sub_calculators, &config, &pitch_table, &warp_table, has_pitch, has_warp](blink_Position p, float* derivative)
 	{
 		auto x { static_cast<blink_Position>(p) };
 
-		if (config.env.pitch && config.env.pitch->points.count > 0)
+		if (has_pitch)
 		{
 			if (x < sub_calculators.prev_positions.pre_pitch)
 			{
@@ -123,7 +158,7 @@ inline void Tape::apply_reverse(const Config& config, int count) {
 
 			sub_calculators.prev_positions.pre_pitch = x;
 
-			x = sub_calculators.pitch.xform(sub_calculators.pitch_config, x, derivative);
+			x = sub_calculators.pitch.xform(pitch_table, x, derivative);
 		}
 		else
 		{
@@ -134,7 +169,7 @@ inline void Tape::apply_reverse(const Config& config, int count) {
 
 		x -= config.sample_offset;
 
-		if (config.warp_points && config.warp_points->count > 0)
+		if (has_warp)
 		{
 			if (x < sub_calculators.prev_positions.pre_warp)
 			{
@@ -145,7 +180,7 @@ inline void Tape::apply_reverse(const Config& config, int count) {
 
 			float ff;
 
-			x = sub_calculators.warp(config.warp_points, x, &ff);
+			x = sub_calculators.warp(warp_table, x, &ff);
 
 			*derivative *= ff;
 		}
@@ -154,16 +189,238 @@ inline void Tape::apply_reverse(const Config& config, int count) {
 
 		return p;
 	}};
+	calculators::ReverseTable::TransformKey key;
+	key.sample_offset = config.sample_offset;
+	key.ff            = has_pitch ? 0.0f : snd::convert::P2FF(config.transpose);
+	key.env_version   = has_pitch ? pitch_table.get_version() : 0;
+	key.warp_version  = has_warp ? warp_table.get_version() : 0;
+	tables->reverse.update(config.unit_state_id, config.option.reverse, key, transform_position);
+}
 
-	calculators::Reverse::Config calculator_config;
+inline auto Tape::get_stages(const Config& config) -> Stages {
+	Stages out;
+	out.pitch   = config.env.pitch && config.env.pitch->points.count > 0;
+	out.warp    = config.warp_points && config.warp_points->count > 0;
+	out.reverse = config.option.reverse && config.option.reverse->points.count > 1;
+	out.flat_ff = out.pitch ? 1.0f : get_flat_pitch_ff(config);
+	return out;
+}
+
+inline auto Tape::update_tables(const Config& config, const Stages& stages, Tables* tables) -> void {
+	if (stages.pitch) {
+		tables->pitch.update(config.unit_state_id, config.env.pitch, config.transpose);
+	}
+	if (stages.warp) {
+		tables->warp.update(config.unit_state_id, config.warp_points);
+	}
+	if (stages.reverse) {
+		update_reverse_table(config, stages.pitch, stages.warp, tables);
+	}
+}
 
-	calculator_config.option.reverse = config.option.reverse;
-	calculator_config.outputs.positions = &stage_.positions.reversed;
-	calculator_config.outputs.correction_grains = config.outputs.correction_grains ? &stage_.correction_grains : nullptr;
-	calculator_config.unit_state_id = config.unit_state_id;
-	calculator_config.transform_position = transform_position;
+inline auto Tape::update_tables(const Config& config, Tables* tables) -> void {
+	update_tables(config, get_stages(config), tables);
+}
 
-	calculators_.reverse(calculator_config, stage_.positions.warped, count);
+inline void Tape::xform(Config config, const BlockPositions& block_positions, int count) {
+	const auto stages      = get_stages(config);
+	const auto has_pitch   = stages.pitch;
+	const auto has_warp    = stages.warp;
+	const auto has_reverse = stages.reverse;
+	const auto flat_ff     = stages.flat_ff;
+	if (!shared_tables_) {
+		update_tables(config, stages, &tables_);
+	}
+	if (config.outputs.correction_grains) {
+		stage_.correction_grains.count = 0;
+	}
+	const auto& tables           = get_tables();
+	const auto& pitch_table      = tables.pitch;
+	const auto& warp_table       = tables.warp;
+	const auto correction_grains = config.outputs.correction_grains ? &stage_.correction_grains : nullptr;
+	traverser_.generate(config.unit_state_id, block_positions, count);
+	const auto& resets = traverser_.get_resets();
+	auto& out = stage_.positions;
+	if (config.outputs.positions.pitched) out.pitched.rotate_prev_pos();
+	if (config.outputs.positions.warped) out.warped.rotate_prev_pos();
+	out.reversed.rotate_prev_pos();
+	const auto reset = [this]() {
+		calculators_.pitch.reset();
+		calculators_.warp.reset();
+		calculators_.reverse.reset();
+	};
+	// Everything after the pitch stage
+	const auto process_pitched = [&](int i, blink_Position x, float pitch_ff) {
+		Lane lane;
+		x -= config.sample_offset;
+		lane.pitched = x;
+		if (config.outputs.positions.pitched) out.pitched.positions[i] = x;
+		if (config.outputs.derivatives.pitch) stage_.derivatives.pitched[i] = pitch_ff;
+		auto warp_ff = 1.0f;
+		if (has_warp) {
+			x = calculators_.warp(warp_table, x, &warp_ff);
+		}
+		lane.warped = x;
+		if (config.outputs.positions.warped) out.warped.positions[i] = x;
+		if (config.outputs.derivatives.warped) stage_.derivatives.warped[i] = warp_ff;
+		if (has_reverse) {
+			x = calculators_.reverse(tables.reverse, correction_grains, i, x);
+		}
+		lane.reversed = x;
+		out.reversed.positions[i] = x;
+		return lane;
+	};
+	const auto process = [&](int i, blink_Position x) {
+		auto pitch_ff = flat_ff;
+		if (has_pitch) {
+			x = calculators_.pitch.xform(pitch_table, x, &pitch_ff);
+		}
+		else {
+			x *= flat_ff;
+		}
+		return process_pitched(i, x, pitch_ff);
+	};
+	if (!block_positions.is_materialized() && count > 1 && block_positions.is_increasing_ramp()) {
+		const auto& ramp = *block_positions.ramp;
+		Lane last;
+		if (get_end(config, stages, ramp.at(0), ramp.at(count - 1), true, &last)) {
+			// Every stage is linear over this vector so the lanes in between
+			// lie on a straight line. Any correction grain is generated by
+			// the first lane.
+			if (resets[0] > 0) {
+				reset();
+			}
+			const auto first = process(0, ramp.at(0));
+			const auto fill = [count](blink_Position y0, blink_Position y1, snd::frame_vec<64>* out) {
+				const auto slope = (y1 - y0) / (count - 1);
+				for (int i = 1; i < count - 1; i++) {
+					(*out)[i] = y0 + (i * slope);
+				}
+				(*out)[count - 1] = y1;
+			};
+			if (config.outputs.positions.pitched) fill(first.pitched, last.pitched, &out.pitched.positions);
+			if (config.outputs.positions.warped) fill(first.warped, last.warped, &out.warped.positions);
+			fill(first.reversed, last.reversed, &out.reversed.positions);
+			if (config.outputs.derivatives.pitch) stage_.derivatives.pitched = stage_.derivatives.pitched[0];
+			if (config.outputs.derivatives.warped) stage_.derivatives.warped = stage_.derivatives.warped[0];
+			return;
+		}
+	}
+	snd::frame_vec<64> ramp_positions;
+	auto in = block_positions.positions.data();
+	if (!block_positions.is_materialized()) {
+		for (int i = 0; i < count; i++) {
+			ramp_positions[i] = block_positions.get(i);
+		}
+		in = ramp_positions.data();
+	}
+	if (has_pitch) {
+		// The pitch stage is done for each run of lanes in the same segment
+		// at once. A lane comes out the same whichever vector it lands in,
+		// so a draw doesn't depend on how it was split up.
+		snd::frame_vec<64> pitched;
+		std::array<float, BLINK_VECTOR_SIZE> pitch_ff;
+		for (int i = 0; i < count;) {
+			const auto segment = calculators_.pitch.seek(pitch_table, in[i]);
+			auto end = i + 1;
+			while (end < count && pitch_table.in_segment(segment, in[end], in[end])) {
+				end++;
+			}
+			pitch_table.xform_vec(segment, in + i, end - i, pitched.data() + i, pitch_ff.data() + i);
+			i = end;
+		}
+		for (int i = 0; i < count; i++) {
+			if (resets[i] > 0) {
+				reset();
+			}
+			process_pitched(i, pitched[i], pitch_ff[i]);
+		}
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		if (resets[i] > 0) {
+			reset();
+		}
+		process(i, in[i]);
+	}
+}
+
+// Runs every stage backwards, from a final sample position to a block
+// position, without moving any of the cursors. Where reversal means the
+// sample position is reached more than once, the leftmost block position
+// is returned. Returns nothing if it is never reached.
+inline auto Tape::inverse(Config config, blink_Position sample_position) -> std::optional<blink_Position> {
+	const auto stages = get_stages(config);
+	if (!shared_tables_) {
+		update_tables(config, stages, &tables_);
+	}
+	const auto& tables = get_tables();
+	auto x = sample_position;
+	if (stages.reverse) {
+		const auto unreversed = tables.reverse.inverse(x);
+		if (!unreversed) {
+			return std::nullopt;
+		}
+		x = *unreversed;
+	}
+	if (stages.warp) {
+		x = tables.warp.inverse(x);
+	}
+	x += config.sample_offset;
+	if (stages.pitch) {
+		return tables.pitch.inverse(x);
+	}
+	return x / stages.flat_ff;
+}
+
+inline auto Tape::is_smooth(const Config& config, blink_Position x0, blink_Position x1) const -> bool {
+	Lane end;
+	return get_end(config, get_stages(config), x0, x1, false, &end);
+}
+
+// Evaluates every stage at x1 without moving any of the cursors. Returns
+// false if a breakpoint is crossed in between x0 and x1, or if [linear]
+// is set and the pitch is ramping.
+inline auto Tape::get_end(const Config& config, const Stages& stages, blink_Position x0, blink_Position x1, bool linear, Lane* end) const -> bool {
+	const auto& pitch_table   = get_tables().pitch;
+	const auto& warp_table    = get_tables().warp;
+	const auto& reverse_table = get_tables().reverse;
+	if (stages.pitch) {
+		const auto k0 = pitch_table.find_segment(x0, 0);
+		const auto k1 = pitch_table.find_segment(x1, k0);
+		if (k0 != k1 || (linear && pitch_table.is_ramp(k0))) {
+			return false;
+		}
+		x0 = pitch_table.xform(k0, x0);
+		x1 = pitch_table.xform(k1, x1);
+	}
+	else {
+		x0 *= stages.flat_ff;
+		x1 *= stages.flat_ff;
+	}
+	x0 -= config.sample_offset;
+	x1 -= config.sample_offset;
+	end->pitched = x1;
+	if (stages.warp) {
+		const auto k0 = warp_table.find_segment(x0, 0);
+		const auto k1 = warp_table.find_segment(x1, k0);
+		if (k0 != k1) {
+			return false;
+		}
+		x0 = warp_table.xform(k0, x0);
+		x1 = warp_table.xform(k1, x1);
+	}
+	end->warped = x1;
+	if (stages.reverse) {
+		const auto k0 = reverse_table.find_segment(x0, 0);
+		const auto k1 = reverse_table.find_segment(x1, k0);
+		if (k0 != k1) {
+			return false;
+		}
+		x1 = reverse_table.xform(k1, x1);
+	}
+	end->reversed = x1;
+	return true;
 }
 
 } // transform
@@ -34,16 +34,29 @@ public:
 		block_positions_ = &block_positions;
 		reset_ = 0;
 
+		// An increasing ramp can only jump backwards at the start
+		if (block_positions.is_increasing_ramp())
+		{
+			if (block_positions.get(0) < block_positions.prev_pos)
+			{
+				reset_[0] = 1;
+			}
+
+			return;
+		}
+
 		auto position = block_positions.prev_pos;
 
 		for (int i = 0; i < n; i++)
 		{
-			if (block_positions.positions[i] < position)
+			const auto next = block_positions.get(i);
+
+			if (next < position)
 			{
 				reset_[i] = 1;
 			}
 
-			position = block_positions.positions[i];
+			position = next;
 		}
 	}
 
@@ -71,6 +71,7 @@ struct GroupInfo {
 
 struct ApplyOffsetFn      { blink_ApplyOffsetFn fn = nullptr; };
 struct StepifyFn          { blink_Tweak_StepifyReal fn = nullptr; };
+struct ApiVersion         { int value = 1; };
 struct ClampRange         { std::optional<blink_Range> value; };
 struct DefaultSnapAmount  { float value = 0.0f; };
 struct EnvFlags           { int value = 0; };
@@ -129,6 +130,7 @@ struct UnitProcess {
 };
 
 struct PluginInterface {
+	using exchange_api_version_fn = std::function<int(int host_version)>;
 	using get_error_string_fn = std::function<blink_TempString(blink_Error error)>;
 	using get_plugin_info_fn = std::function<blink_PluginInfo()>;
 	using get_resource_data_fn = std::function<blink_ResourceData(const char* path)>;
@@ -141,6 +143,8 @@ struct PluginInterface {
 	using unit_add_fn = std::function<blink_UnitIdx(blink_InstanceIdx instance_idx)>;
 	using unit_reset_fn = std::function<blink_Error(blink_UnitIdx unit_idx)>;
 	using unit_stream_init_fn = std::function<blink_Error(blink_UnitIdx unit_idx, blink_SR SR)>;
+	// Optional
+	exchange_api_version_fn exchange_api_version;
 	get_error_string_fn     get_error_string;
 	get_plugin_info_fn      get_plugin_info;
 	get_resource_data_fn    get_resource_data;
@@ -164,10 +168,12 @@ struct PluginInterface {
 		using analyze_sample_fn = std::function<blink_AnalysisResult(void* host, blink_AnalysisCallbacks callbacks, const blink_SampleInfo* sample_info)>;
 		using sample_deleted_fn = std::function<blink_Error(blink_ID sample_id)>;
 		using draw_fn = std::function<blink_Error(const blink_SamplerVaryingData* varying, const blink_SamplerUniformData* uniform, blink_FrameCount n, blink_SamplerDrawInfo* out)>;
-		using get_sonic_fragment_at_block_position_fn = std::function<double(blink_Position block_position)>;
-		using block_position_for_sonic_fragment_fn = std::function<blink_Position(double fragment)>;
+		using draw_stream_fn = std::function<blink_Error(const blink_SamplerVaryingData* varying, const blink_SamplerUniformData* uniform, blink_FrameCount n, const blink_SamplerDrawStream* stream)>;
+		using get_sonic_fragment_at_block_position_fn = std::function<double(const blink_SampleInfo* sample_info, const blink_SamplerUniformData* uniform, blink_Position block_position)>;
+		using block_position_for_sonic_fragment_fn = std::function<blink_Bool(const blink_SampleInfo* sample_info, const blink_SamplerUniformData* uniform, double fragment, blink_Position* out)>;
 		block_position_for_sonic_fragment_fn    block_position_for_sonic_fragment;
 		draw_fn                                 draw;
+		draw_stream_fn                          draw_stream;
 		get_sonic_fragment_at_block_position_fn get_sonic_fragment_at_block_position;
 		analyze_sample_fn                       analyze_sample;
 		process_fn                              process;
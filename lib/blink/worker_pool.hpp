@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads for splitting a big job into independent pieces,
+// e.g. drawing a waveform in chunks. The thread which calls run() does a
+// share of the work too, and with no extra threads everything is done
+// inline.
+//
+// Not for the audio thread. run() blocks until every piece is done.
+
+namespace blink {
+
+class WorkerPool {
+public:
+	using Job = std::function<void(size_t index)>;
+	// [threads] is the number of threads besides the caller of run()
+	explicit WorkerPool(int threads = default_threads());
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+	// Calls job(i) for every i in [0, count). Safe to call from several
+	// threads at once, but the calls are done one at a time.
+	auto run(size_t count, const Job& job) -> void;
+	[[nodiscard]] auto get_thread_count() const -> int { return int(threads_.size()); }
+	[[nodiscard]] static auto default_threads() -> int { return std::max(int(std::thread::hardware_concurrency()) - 1, 0); }
+private:
+	auto work() -> void;
+	auto worker_thread() -> void;
+	std::vector<std::thread> threads_;
+	std::mutex run_mutex_;
+	std::mutex mutex_;
+	std::condition_variable start_cv_;
+	std::condition_variable done_cv_;
+	const Job* job_ = nullptr;
+	size_t count_ = 0;
+	std::atomic<size_t> next_ = 0;
+	int busy_ = 0;
+	uint64_t generation_ = 0;
+	bool quit_ = false;
+};
+
+inline
+WorkerPool::WorkerPool(int threads) {
+	for (int i = 0; i < threads; i++) {
+		threads_.emplace_back([this] { worker_thread(); });
+	}
+}
+
+inline
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard lock{mutex_};
+		quit_ = true;
+	}
+	start_cv_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+inline
+auto WorkerPool::run(size_t count, const Job& job) -> void {
+	if (threads_.empty() || count < 2) {
+		for (size_t i = 0; i < count; i++) {
+			job(i);
+		}
+		return;
+	}
+	std::lock_guard run_lock{run_mutex_};
+	{
+		std::lock_guard lock{mutex_};
+		job_   = &job;
+		count_ = count;
+		next_  = 0;
+		busy_  = int(threads_.size());
+		generation_++;
+	}
+	start_cv_.notify_all();
+	work();
+	std::unique_lock lock{mutex_};
+	done_cv_.wait(lock, [this] { return busy_ == 0; });
+	job_ = nullptr;
+}
+
+// Takes pieces until there are none left
+inline
+auto WorkerPool::work() -> void {
+	for (auto i = next_.fetch_add(1, std::memory_order_relaxed); i < count_; i = next_.fetch_add(1, std::memory_order_relaxed)) {
+		(*job_)(i);
+	}
+}
+
+inline
+auto WorkerPool::worker_thread() -> void {
+	uint64_t generation = 0;
+	for (;;) {
+		{
+			std::unique_lock lock{mutex_};
+			start_cv_.wait(lock, [this, generation] { return quit_ || generation_ != generation; });
+			if (quit_) {
+				return;
+			}
+			generation = generation_;
+		}
+		work();
+		{
+			std::lock_guard lock{mutex_};
+			if (--busy_ == 0) {
+				done_cv_.notify_one();
+			}
+		}
+	}
+}
+
+} // blink
@@ -1,6 +1,9 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include <blink/host_impl.hpp>
+#include <blink/sample_stream.hpp>
+#include <chrono>
+#include <thread>
 
 TEST_CASE("no test") {
 	auto host = blink::Host{};
@@ -8,3 +11,223 @@ TEST_CASE("no test") {
 	auto env_pitch = blink::add::env::pitch(&host);
 	auto sld_speed = blink::add::slider::speed(&host);
 }
+
+namespace {
+
+// Every output is a different function of the block position, and each
+// channel of the peaks is different again, so anything which ends up at
+// the wrong pixel or in the wrong row shows up. Like draw::peaks(), the
+// values also depend on the neighbouring positions, guessed from the
+// other side at the edges, so a pixel drawn without its real neighbours
+// shows up too.
+struct StubSampler {
+	uint64_t pixels_drawn = 0;
+	auto draw(const blink_SamplerVaryingData* varying, blink_FrameCount n, blink_SamplerDrawInfo* out) -> blink_Error {
+		const auto channels  = uint64_t(varying->sample_info->num_channels.value);
+		const auto positions = blink::draw_stream::get_position_outputs(out);
+		const auto values    = blink::draw_stream::get_value_outputs(out);
+		const auto p         = varying->base.positions;
+		for (uint64_t i = 0; i < n.value; i++) {
+			const auto x    = p[i];
+			const auto prev = i > 0 ? p[i - 1] : n.value > 1 ? x - (p[1] - x) : x - 1.0;
+			const auto next = i + 1 < n.value ? p[i + 1] : n.value > 1 ? x + (x - p[i - 1]) : x + 1.0;
+			const auto span = float((next - prev) * 10000.0);
+			for (size_t k = 0; k < positions.size(); k++) {
+				if (*positions[k]) (*positions[k])[i] = x * double(k + 2);
+			}
+			for (int k = 0; k < int(values.size()); k++) {
+				if (!*values[k]) continue;
+				for (uint64_t c = 0; c < blink::draw_stream::get_value_rows(k, channels); c++) {
+					(*values[k])[(c * n.value) + i] = float(x) + span + float(k * 100000) + float(c * 10000000);
+				}
+			}
+		}
+		pixels_drawn += n.value;
+		return BLINK_OK;
+	}
+};
+
+// Every output of a draw, as blink_SamplerDrawInfo wants them
+struct DrawBuffers {
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> values;
+	blink_SamplerDrawInfo info = {};
+	DrawBuffers(uint64_t n, uint64_t channels) {
+		const auto info_positions = blink::draw_stream::get_position_outputs(&info);
+		const auto info_values    = blink::draw_stream::get_value_outputs(&info);
+		for (size_t i = 0; i < positions.size(); i++) {
+			positions[i].resize(n);
+			*info_positions[i] = positions[i].data();
+		}
+		for (int i = 0; i < int(values.size()); i++) {
+			values[i].resize(n * blink::draw_stream::get_value_rows(i, channels));
+			*info_values[i] = values[i].data();
+		}
+	}
+};
+
+} // namespace
+
+TEST_CASE("scrolled sampler draw cache matches a full draw") {
+	constexpr auto N        = uint64_t(1000);
+	constexpr auto CHANNELS = uint64_t(2);
+	constexpr auto ZOOM     = 2.5;
+	// The pixels aren't evenly spaced, e.g. because of a pitch envelope
+	const auto get_block_position = [](int64_t pixel) { return (double(pixel) * ZOOM) + (double(pixel) * double(pixel) * 0.01); };
+	auto host    = blink::Host{};
+	auto sampler = StubSampler{};
+	const auto plugin_idx = blink::add::plugin(&host, blink::PluginType::sampler);
+	host.plugin.set(plugin_idx.value, blink::ApiVersion{BLINK_API_VERSION});
+	host.plugin.get<blink::PluginInterface>(plugin_idx.value).sampler.draw = [&sampler](const blink_SamplerVaryingData* varying, const blink_SamplerUniformData*, blink_FrameCount n, blink_SamplerDrawInfo* out) {
+		return sampler.draw(varying, n, out);
+	};
+	blink_SampleInfo sample_info = {};
+	sample_info.id           = {1};
+	sample_info.num_channels = {uint8_t(CHANNELS)};
+	blink_SamplerUniformData uniform = {};
+	uniform.base.id = 1;
+	auto cache = blink::SamplerDrawCache{};
+	std::vector<blink_Position> block_positions(N);
+	const auto draw = [&](bool cached, int64_t first_pixel, DrawBuffers* out) {
+		for (uint64_t i = 0; i < N; i++) {
+			block_positions[i] = get_block_position(first_pixel + int64_t(i));
+		}
+		blink_SamplerVaryingData varying = {};
+		varying.base.positions = block_positions.data();
+		varying.sample_info    = &sample_info;
+		if (cached) {
+			return blink::sampler_draw(host, &cache, plugin_idx, varying, uniform, ZOOM, first_pixel, {N}, &out->info);
+		}
+		return blink::sampler_draw(host, plugin_idx, varying, uniform, {N}, &out->info);
+	};
+	struct Step {
+		int64_t first_pixel;
+		uint64_t expected_pixels_drawn;
+	};
+	// Scrolling right, left, past the end of the cache and not at all. The
+	// pixels either side of each newly drawn range are drawn again.
+	const auto steps = std::vector<Step>{{0, N}, {100, 104}, {40, 64}, {-30, 74}, {5000, N}, {5000, 0}, {5999, N}};
+	for (const auto& step : steps) {
+		CAPTURE(step.first_pixel);
+		auto cached   = DrawBuffers{N, CHANNELS};
+		auto expected = DrawBuffers{N, CHANNELS};
+		sampler.pixels_drawn = 0;
+		REQUIRE(draw(true, step.first_pixel, &cached) == BLINK_OK);
+		CHECK(sampler.pixels_drawn == step.expected_pixels_drawn);
+		REQUIRE(draw(false, step.first_pixel, &expected) == BLINK_OK);
+		for (size_t i = 0; i < cached.positions.size(); i++) {
+			CHECK(cached.positions[i] == expected.positions[i]);
+		}
+		for (size_t i = 0; i < cached.values.size(); i++) {
+			CHECK(cached.values[i] == expected.values[i]);
+		}
+	}
+	SUBCASE("changing the zoom throws the cache away") {
+		auto out = DrawBuffers{N, CHANNELS};
+		sampler.pixels_drawn = 0;
+		block_positions.assign(N, 0.0);
+		blink_SamplerVaryingData varying = {};
+		varying.base.positions = block_positions.data();
+		varying.sample_info    = &sample_info;
+		REQUIRE(blink::sampler_draw(host, &cache, plugin_idx, varying, uniform, ZOOM * 2, 5999, {N}, &out.info) == BLINK_OK);
+		CHECK(sampler.pixels_drawn == N);
+	}
+}
+
+TEST_CASE("plugins built against version 1 are passed the version 1 layouts") {
+	auto host = blink::Host{};
+	const auto plugin_idx = blink::add::plugin(&host, blink::PluginType::sampler);
+	blink_SampleInfo sample_info = {};
+	std::vector<blink_Position> block_positions(10);
+	auto received = blink::compat::v1::SamplerVaryingData{};
+	host.plugin.get<blink::PluginInterface>(plugin_idx.value).sampler.draw = [&received](const blink_SamplerVaryingData* varying, const blink_SamplerUniformData*, blink_FrameCount, blink_SamplerDrawInfo*) {
+		received = *reinterpret_cast<const blink::compat::v1::SamplerVaryingData*>(varying);
+		return BLINK_OK;
+	};
+	blink_SamplerVaryingData varying = {};
+	varying.base.positions = block_positions.data();
+	varying.base.ramp      = {0.0, 1.0, 10};
+	varying.sample_info    = &sample_info;
+	varying.analysis_ready = {BLINK_TRUE};
+	blink_SamplerUniformData uniform = {};
+	blink_SamplerDrawInfo out = {};
+	REQUIRE(blink::read::api_version(host, plugin_idx) == 1);
+	REQUIRE(blink::sampler_draw(host, plugin_idx, varying, uniform, {10}, &out) == BLINK_OK);
+	CHECK(received.base.positions == block_positions.data());
+	CHECK(received.sample_info == &sample_info);
+	CHECK(received.analysis_ready.value == BLINK_TRUE);
+	CHECK(blink::compat::sampler_info(1, {{BLINK_TRUE}, {BLINK_TRUE}, {BLINK_TRUE}}).draws_peaks.value == BLINK_FALSE);
+	CHECK(blink::compat::sampler_info(2, {{BLINK_TRUE}, {BLINK_TRUE}, {BLINK_TRUE}}).draws_peaks.value == BLINK_TRUE);
+}
+
+TEST_CASE("sample stream reads what the reader read, once it's resident") {
+	using blink::SampleStream;
+	constexpr auto BLOCK = uint64_t(SampleStream::BLOCK_FRAMES);
+	// The last block is short
+	constexpr auto N = (5 * BLOCK) + 100;
+	const auto source = [](uint8_t channel, uint64_t frame) {
+		return (float(frame % 9973) * 0.001f) + float(channel);
+	};
+	const auto reader = [&source](uint64_t index, uint64_t size, float* const* buffers) {
+		for (uint8_t c = 0; c < 2; c++) {
+			for (uint64_t i = 0; i < size; i++) {
+				buffers[c][i] = source(c, index + i);
+			}
+		}
+		return size;
+	};
+	// Four slots, so block 4 evicts block 0
+	SampleStream stream{{2}, {N}, 4, reader};
+	const auto wait_for_loads = [&stream](uint64_t loads) {
+		for (int i = 0; i < 5000 && stream.get_stats().loads < loads; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		}
+		return stream.get_stats().loads;
+	};
+	std::vector<float> buffer(3 * BLOCK);
+	const auto read = [&](uint8_t channel, uint64_t index, uint64_t size) {
+		std::fill(buffer.begin(), buffer.end(), -1.0f);
+		return stream.get_data({channel}, {index}, {size}, buffer.data()).value;
+	};
+	const auto mismatches = [&](uint8_t channel, uint64_t index, uint64_t size) {
+		auto out = 0;
+		for (uint64_t i = 0; i < size; i++) {
+			out += buffer[i] == source(channel, index + i) ? 0 : 1;
+		}
+		return out;
+	};
+	stream.read_ahead({0}, {3 * BLOCK});
+	REQUIRE(wait_for_loads(3) == 3);
+	// Across all three blocks
+	CHECK(read(1, 1000, 2 * BLOCK) == 2 * BLOCK);
+	CHECK(mismatches(1, 1000, 2 * BLOCK) == 0);
+	CHECK(stream.get_stats().hits == 3);
+	CHECK(stream.get_stats().misses == 0);
+	// Block 4 was never asked for
+	stream.reset_stats();
+	CHECK(read(0, (4 * BLOCK) + 10, 100) == 100);
+	CHECK(std::all_of(buffer.begin(), buffer.begin() + 100, [](float x) { return x == 0.0f; }));
+	CHECK(buffer[100] == -1.0f);
+	CHECK(stream.get_stats().hits == 0);
+	CHECK(stream.get_stats().misses == 1);
+	// The miss asked for it, so it turns up
+	REQUIRE(wait_for_loads(1) == 1);
+	CHECK(read(0, (4 * BLOCK) + 10, 100) == 100);
+	CHECK(mismatches(0, (4 * BLOCK) + 10, 100) == 0);
+	CHECK(stream.get_stats().hits == 1);
+	// and block 0 is gone
+	CHECK(read(0, 0, 10) == 10);
+	CHECK(std::all_of(buffer.begin(), buffer.begin() + 10, [](float x) { return x == 0.0f; }));
+	CHECK(stream.get_stats().misses == 2);
+	REQUIRE(wait_for_loads(2) == 2);
+	// The short block, read past the end
+	stream.reset_stats();
+	stream.read_ahead({5 * BLOCK}, {N});
+	REQUIRE(wait_for_loads(1) == 1);
+	CHECK(read(1, N - 50, 100) == 50);
+	CHECK(mismatches(1, N - 50, 50) == 0);
+	CHECK(buffer[50] == -1.0f);
+	CHECK(stream.get_stats().hits == 1);
+	CHECK(read(2, 0, 10) == 0);
+	CHECK(read(0, N, 10) == 0);
+}
@@ -1,5 +1,936 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
+#include <blink/draw.hpp>
+#include <blink/peak_pyramid.hpp>
+#include <blink/plugin_impl.hpp>
+#include <blink/sample_store.hpp>
+#include <blink/transform/stretch.hpp>
+#include <blink/transform/tape.hpp>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
 
-TEST_CASE("no test") {
+namespace {
+
+using namespace blink;
+using namespace blink::transform;
+
+[[nodiscard]]
+auto rel_error(double a, double b) -> double {
+	return std::abs(a - b) / std::max(1.0, std::abs(a));
+}
+
+[[nodiscard]]
+auto make_real_points(std::mt19937* rng, float min_y, float max_y) -> std::vector<blink_RealPoint> {
+	std::vector<blink_RealPoint> out(1 + (*rng)() % 6);
+	auto x = -200.0;
+	auto y = std::uniform_real_distribution<float>{min_y, max_y};
+	for (auto& p : out) {
+		x   += double(1 + (*rng)() % 3000);
+		p.x  = x;
+		p.y  = y(*rng);
+	}
+	return out;
+}
+
+[[nodiscard]]
+auto make_warp_points(std::mt19937* rng) -> std::vector<blink_WarpPoint> {
+	std::vector<blink_WarpPoint> out(1 + (*rng)() % 5);
+	auto x = int64_t(0);
+	auto y = int64_t(0);
+	for (auto& p : out) {
+		x += 200 + (*rng)() % 3000;
+		y += 200 + (*rng)() % 3000;
+		p  = {x, y, 0.0f};
+	}
+	return out;
+}
+
+// Any mix of normal, mirror, tape and slip segments, so reversed
+// segments overlap each other
+[[nodiscard]]
+auto make_reverse_points(std::mt19937* rng) -> std::vector<blink_IntPoint> {
+	std::vector<blink_IntPoint> out(2 + (*rng)() % 5);
+	auto x = 0.0;
+	for (auto& p : out) {
+		x   += double(300 + (*rng)() % 4000);
+		p.x  = x;
+		p.y  = int64_t((*rng)() % 4) - 1;
+	}
+	return out;
+}
+
+[[nodiscard]]
+auto make_env(std::vector<blink_RealPoint>* points, float min, float max) -> blink_UniformEnvData {
+	blink_UniformEnvData out = {};
+	out.points.count = points->size();
+	out.points.data  = points->data();
+	out.points.min   = min;
+	out.points.max   = max;
+	return out;
+}
+
+// No points, so the speed is flat at 1 times Stretch::Config::speed
+[[nodiscard]]
+auto make_flat_speed_env() -> blink_UniformEnvData {
+	blink_UniformEnvData out = {};
+	out.points.min = 0.0f;
+	out.points.max = 4.0f;
+	return out;
+}
+
+[[nodiscard]]
+auto make_option(std::vector<blink_IntPoint>* points) -> blink_UniformOptionData {
+	blink_UniformOptionData out = {};
+	out.points.count = points->size();
+	out.points.data  = points->data();
+	return out;
+}
+
+// Positions which mostly step forwards, with occasional jumps backwards
+// and forwards, as a cursor would see them
+template <typename Fn>
+auto walk(std::mt19937* rng, Fn&& fn) -> void {
+	auto x = -300.25;
+	for (int i = 0; i < 4000; i++) {
+		fn(x);
+		x += (*rng)() % 10 == 0 ? 0.5 : 1.0;
+		if ((*rng)() % 100 == 0) {
+			x = double(int((*rng)() % 16000) - 1000) + 0.25;
+		}
+	}
+}
+
+// The original walk-every-segment formulas which the tables replaced
+namespace baseline {
+
+[[nodiscard]]
+auto pitch(const blink_UniformEnvData& env, float transpose, blink_Position x, float* derivative) -> blink_Position {
+	const auto& points = env.points;
+	const auto point   = [&](size_t i) { return calculators::make_pitch_point(points.data[i], points.min, points.max, transpose); };
+	auto p1 = point(0);
+	if (x < p1.x) {
+		*derivative = p1.ff;
+		return x * p1.ff;
+	}
+	auto start = p1.x * p1.ff;
+	for (size_t i = 1; i < points.count; i++) {
+		const auto p0   = p1;
+		const auto size = (p1 = point(i)).x - p0.x;
+		if (x < p1.x) {
+			*derivative = float(calculators::weird_math_ff(double(p0.pitch), double(p1.pitch), size, x - p0.x));
+			return start + calculators::weird_math(double(p0.pitch), double(p1.pitch), size, x - p0.x);
+		}
+		start += calculators::weird_math(double(p0.pitch), double(p1.pitch), size, size);
+	}
+	*derivative = p1.ff;
+	return start + ((x - p1.x) * p1.ff);
+}
+
+[[nodiscard]]
+auto speed(const blink_UniformEnvData& env, float speed, blink_Position x, float* derivative) -> blink_Position {
+	const auto& points = env.points;
+	const auto point   = [&](size_t i) { return calculators::make_speed_point(points.data[i], points.min, points.max, speed); };
+	auto p1 = point(0);
+	if (x < p1.x) {
+		*derivative = float(p1.ff);
+		return x * p1.ff;
+	}
+	auto start = p1.x * p1.ff;
+	for (size_t i = 1; i < points.count; i++) {
+		const auto p0   = p1;
+		const auto size = (p1 = point(i)).x - p0.x;
+		if (x < p1.x) {
+			*derivative = float(std::lerp(p0.ff, p1.ff, (x - p0.x) / size));
+			return calculators::spooky_maths(p0.ff, p1.ff, size, x - p0.x, start);
+		}
+		// The running total was always rounded to float
+		if (p0.y > 0.0f || p1.y > 0.0f) {
+			start = float(calculators::spooky_maths(p0.ff, p1.ff, size, size, start));
+		}
+	}
+	*derivative = float(p1.ff);
+	if (p1.y == 0.0f) {
+		return start;
+	}
+	return float(start + ((x - p1.x) * p1.ff));
+}
+
+[[nodiscard]]
+auto warp(const blink_WarpPoints& points, blink_Position x, float* derivative) -> blink_Position {
+	*derivative = 1.0f;
+	if (x < points.points[0].y) {
+		return points.points[0].x + (x - points.points[0].y);
+	}
+	for (size_t i = 1; i < points.count; i++) {
+		const auto& p0 = points.points[i - 1];
+		const auto& p1 = points.points[i];
+		if (x < p1.y) {
+			*derivative = float(p1.x - p0.x) / float(p1.y - p0.y);
+			return p0.x + ((x - p0.y) / double(p1.y - p0.y) * double(p1.x - p0.x));
+		}
+	}
+	const auto& last = points.points[points.count - 1];
+	return last.x + (x - last.y);
+}
+
+template <typename TransformFn> [[nodiscard]]
+auto reverse(const blink_UniformOptionData& option, TransformFn&& transform_position, blink_Position x) -> blink_Position {
+	const auto& points = option.points;
+	const auto point_x = [&](size_t i) { float ff; return transform_position(points.data[i].x, &ff); };
+	if (x < point_x(0)) {
+		return x;
+	}
+	auto start = point_x(0);
+	for (size_t i = 1; i < points.count; i++) {
+		const auto x0     = point_x(i - 1);
+		const auto x1     = point_x(i);
+		const auto mode   = points.data[i - 1].y;
+		const auto length = x1 - x0;
+		if (x < x1) {
+			const auto distance = x - x0;
+			switch (mode) {
+				case calculators::ReverseTable::SLIP:
+				case calculators::ReverseTable::TAPE: { return start - distance; }
+				case calculators::ReverseTable::MIRROR: { return x1 - distance; }
+				default: { return start + distance; }
+			}
+		}
+		start = mode == calculators::ReverseTable::TAPE ? start - length : start + length;
+	}
+	return start + (x - point_x(points.count - 1));
+}
+
+} // baseline
+
+[[nodiscard]]
+auto xform(Tape::Config config, blink_Position x) -> blink_Position {
+	Tape tape;
+	tape.xform(config, BlockPositions{&x, 1}, 1);
+	return tape.get_reversed_positions().positions[0];
+}
+
+[[nodiscard]]
+auto xform(Stretch::Config config, blink_Position x) -> blink_Position {
+	Stretch stretch;
+	stretch(config, BlockPositions{&x, 1}, 1);
+	return stretch.get_reversed_positions().positions[0];
+}
+
+// inverse() picks the leftmost block position if there are several, so
+// it only gets back to [x] itself if nothing to its left maps to the same
+// place. Either way it has to land on the same sample position.
+template <typename Transform>
+auto check_inverse(Transform* transform, const typename Transform::Config& config, blink_Position x) -> void {
+	const auto y   = xform(config, x);
+	const auto inv = transform->inverse(config, y);
+	REQUIRE(inv.has_value());
+	CHECK(*inv <= x + (1e-6 * std::max(1.0, std::abs(x))));
+	CHECK(rel_error(y, xform(config, *inv)) < 1e-6);
+}
+
+} // namespace
+
+TEST_CASE("pitch table matches the baseline formula") {
+	std::mt19937 rng(1);
+	for (int trial = 0; trial < 20; trial++) {
+		auto points = make_real_points(&rng, -24.0f, 24.0f);
+		auto env    = make_env(&points, -24.0f, 24.0f);
+		calculators::PitchTable table;
+		calculators::PitchUnit unit;
+		table.update(uint64_t(trial + 1), &env, 1.5f);
+		walk(&rng, [&](blink_Position x) {
+			float expected_derivative, derivative;
+			const auto expected = baseline::pitch(env, 1.5f, x, &expected_derivative);
+			CHECK(rel_error(expected, unit.xform(table, x, &derivative)) < 1e-9);
+			CHECK(rel_error(expected_derivative, derivative) < 1e-5);
+		});
+	}
+}
+
+TEST_CASE("speed table matches the baseline formula") {
+	std::mt19937 rng(2);
+	for (int trial = 0; trial < 20; trial++) {
+		auto points = make_real_points(&rng, 0.0f, 4.0f);
+		// Including stretches where the speed is zero
+		for (auto& p : points) {
+			if (rng() % 4 == 0) p.y = 0.0f;
+		}
+		auto env = make_env(&points, 0.0f, 4.0f);
+		calculators::SpeedTable table;
+		calculators::SpeedUnit unit;
+		table.update(uint64_t(trial + 1), &env, 1.25f);
+		walk(&rng, [&](blink_Position x) {
+			float expected_derivative, derivative;
+			const auto expected = baseline::speed(env, 1.25f, x, &expected_derivative);
+			CHECK(rel_error(expected, unit(table, x, &derivative)) < 1e-9);
+			CHECK(std::abs(expected_derivative - derivative) < 1e-5);
+		});
+	}
+}
+
+TEST_CASE("warp table matches the baseline formula") {
+	std::mt19937 rng(3);
+	for (int trial = 0; trial < 20; trial++) {
+		auto points = make_warp_points(&rng);
+		const auto warp_points = blink_WarpPoints{points.size(), points.data()};
+		calculators::WarpTable table;
+		calculators::WarpUnit unit;
+		table.update(uint64_t(trial + 1), &warp_points);
+		walk(&rng, [&](blink_Position x) {
+			float expected_derivative, derivative;
+			const auto expected = baseline::warp(warp_points, x, &expected_derivative);
+			CHECK(rel_error(expected, unit(table, x, &derivative)) < 1e-9);
+			CHECK(rel_error(expected_derivative, derivative) < 1e-5);
+		});
+	}
+}
+
+TEST_CASE("reverse table matches the baseline formula") {
+	std::mt19937 rng(4);
+	const auto transform_position = [](blink_Position x, float* derivative) {
+		*derivative = 1.5f;
+		return (x * 1.5) - 7.0;
+	};
+	for (int trial = 0; trial < 20; trial++) {
+		auto points = make_reverse_points(&rng);
+		const auto option = make_option(&points);
+		calculators::ReverseTable table;
+		calculators::ReverseUnit unit;
+		table.update(uint64_t(trial + 1), &option, {}, transform_position);
+		walk(&rng, [&](blink_Position x) {
+			const auto expected = baseline::reverse(option, transform_position, x);
+			CHECK(rel_error(expected, unit(table, nullptr, 0, x)) < 1e-9);
+		});
+	}
+}
+
+TEST_CASE("tape inverse") {
+	std::mt19937 rng(5);
+	for (int trial = 0; trial < 60; trial++) {
+		auto pitch_points   = make_real_points(&rng, -12.0f, 12.0f);
+		auto warp_points    = make_warp_points(&rng);
+		auto reverse_points = make_reverse_points(&rng);
+		const auto pitch    = make_env(&pitch_points, -24.0f, 24.0f);
+		const auto warp     = blink_WarpPoints{warp_points.size(), warp_points.data()};
+		const auto reverse  = make_option(&reverse_points);
+		Tape::Config config = {};
+		config.unit_state_id = uint64_t(trial + 1);
+		config.transpose     = 2.0f;
+		config.sample_offset = 13;
+		if (trial % 4 != 0) config.env.pitch = &pitch;
+		if (trial % 3 != 0) config.warp_points = &warp;
+		if (trial % 5 != 0) config.option.reverse = &reverse;
+		Tape tape;
+		for (int i = 0; i < 200; i++) {
+			const auto x = double(int(rng() % 20000) - 500) + 0.25;
+			check_inverse(&tape, config, x);
+			if (!config.option.reverse) {
+				CHECK(rel_error(x, *tape.inverse(config, xform(config, x))) < 1e-6);
+			}
+		}
+	}
+}
+
+TEST_CASE("stretch inverse") {
+	std::mt19937 rng(6);
+	for (int trial = 0; trial < 60; trial++) {
+		// Stopping in between points. Not before the first one, because
+		// then there is no leftmost block position to go back to.
+		auto speed_points = make_real_points(&rng, 0.5f, 3.0f);
+		for (size_t i = 1; i < speed_points.size(); i++) {
+			if (rng() % 3 == 0) speed_points[i].y = 0.0f;
+		}
+		auto warp_points    = make_warp_points(&rng);
+		auto reverse_points = make_reverse_points(&rng);
+		const auto speed    = make_env(&speed_points, 0.0f, 4.0f);
+		const auto warp     = blink_WarpPoints{warp_points.size(), warp_points.data()};
+		const auto reverse  = make_option(&reverse_points);
+		const auto flat     = make_flat_speed_env();
+		Stretch::Config config = {};
+		config.unit_state_id = uint64_t(trial + 1);
+		config.speed         = trial % 8 == 0 ? -1.3f : 1.3f;
+		config.sample_offset = 13;
+		config.env.speed     = trial % 4 != 0 ? &speed : &flat;
+		if (trial % 3 != 0) config.warp_points = &warp;
+		if (trial % 5 != 0) config.option.reverse = &reverse;
+		Stretch stretch;
+		for (int i = 0; i < 200; i++) {
+			const auto x = double(int(rng() % 20000) - 500) + 0.25;
+			if (config.speed < 0.0f && config.option.reverse) {
+				continue;
+			}
+			check_inverse(&stretch, config, x);
+		}
+	}
+}
+
+TEST_CASE("inverse of a sample position which is never reached") {
+	// Slipping back from 1000 to 0 and then carrying on from 2000 means
+	// the sample positions in between are skipped
+	auto reverse_points = std::vector<blink_IntPoint>{{1000.0, calculators::ReverseTable::SLIP}, {2000.0, -1}};
+	const auto reverse  = make_option(&reverse_points);
+	SUBCASE("tape") {
+		Tape::Config config = {};
+		config.unit_state_id  = 1;
+		config.option.reverse = &reverse;
+		Tape tape;
+		CHECK(tape.inverse(config, 500.0).has_value());
+		CHECK_FALSE(tape.inverse(config, 1500.0).has_value());
+		CHECK(tape.inverse(config, 2500.0).has_value());
+	}
+	SUBCASE("stretch") {
+		const auto flat = make_flat_speed_env();
+		Stretch::Config config = {};
+		config.unit_state_id  = 1;
+		config.speed          = 1.0f;
+		config.env.speed      = &flat;
+		config.option.reverse = &reverse;
+		Stretch stretch;
+		CHECK(stretch.inverse(config, 500.0).has_value());
+		CHECK_FALSE(stretch.inverse(config, 1500.0).has_value());
+		CHECK(stretch.inverse(config, 2500.0).has_value());
+		config.speed = 0.0f;
+		CHECK_FALSE(stretch.inverse(config, 500.0).has_value());
+	}
+	SUBCASE("stretch which slows to a stop") {
+		// Comes to a stop at sample position 500
+		auto speed_points = std::vector<blink_RealPoint>{{0.0, 1.0f}, {1000.0, 0.0f}};
+		const auto speed  = make_env(&speed_points, 0.0f, 4.0f);
+		auto tape_points  = std::vector<blink_IntPoint>{{100.0, calculators::ReverseTable::TAPE}, {300.0, -1}};
+		const auto tape   = make_option(&tape_points);
+		Stretch::Config config = {};
+		config.unit_state_id  = 1;
+		config.speed          = 1.0f;
+		config.env.speed      = &speed;
+		config.option.reverse = &tape;
+		Stretch stretch;
+		CHECK(stretch.inverse(config, 50.0).has_value());
+		CHECK_FALSE(stretch.inverse(config, 600.0).has_value());
+	}
+}
+
+TEST_CASE("peak pyramid matches brute force") {
+	std::mt19937 rng(7);
+	auto value = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+	for (const auto num_frames : {1, 15, 17, 4097, 100003}) {
+		std::vector<float> left(num_frames), right(num_frames);
+		for (auto& x : left) x = value(rng);
+		for (auto& x : right) x = value(rng) * 0.5f;
+		const float* const channel_data[] = {left.data(), right.data()};
+		blink_SampleInfo info = {};
+		info.id           = {1};
+		info.num_channels = {2};
+		info.num_frames   = {uint64_t(num_frames)};
+		info.channel_data = channel_data;
+		PeakPyramid pyramid;
+		REQUIRE(pyramid.build(nullptr, {}, info) == blink_AnalysisResult_OK);
+		// Ranges are rounded out to whole blocks and clipped to the sample
+		const auto check = [&](int64_t beg, int64_t end) {
+			const auto empty = std::max(beg, int64_t(0)) >= std::min(end, int64_t(num_frames));
+			const auto b     = std::max(beg, int64_t(0)) / PeakPyramid::BLOCK_FRAMES * PeakPyramid::BLOCK_FRAMES;
+			const auto e     = std::min((end + PeakPyramid::BLOCK_FRAMES - 1) / PeakPyramid::BLOCK_FRAMES * PeakPyramid::BLOCK_FRAMES, int64_t(num_frames));
+			for (uint8_t c = 0; c < 2; c++) {
+				const auto peak = pyramid.get({c}, beg, end);
+				if (empty) {
+					CHECK(peak.min == 0.0f);
+					CHECK(peak.max == 0.0f);
+					CHECK(peak.rms == 0.0f);
+					continue;
+				}
+				auto min    = std::numeric_limits<float>::infinity();
+				auto max    = -std::numeric_limits<float>::infinity();
+				auto sum_sq = 0.0;
+				for (auto i = b; i < e; i++) {
+					const auto x = channel_data[c][i];
+					min     = std::min(min, x);
+					max     = std::max(max, x);
+					sum_sq += double(x) * x;
+				}
+				CHECK(peak.min == min);
+				CHECK(peak.max == max);
+				CHECK(peak.rms == doctest::Approx(std::sqrt(sum_sq / double(e - b))).epsilon(1e-4));
+			}
+		};
+		check(0, num_frames);
+		check(-100, 1);
+		check(-100, num_frames + 100);
+		check(num_frames - 1, num_frames + 100);
+		check(num_frames, num_frames + 100);
+		check(5, 5);
+		for (int i = 0; i < 200; i++) {
+			const auto beg = int64_t(rng() % (num_frames + 40)) - 20;
+			const auto end = beg + int64_t(rng() % (num_frames + 20));
+			check(beg, end);
+		}
+	}
+}
+
+TEST_CASE("a version 1 host's structs are read in the version 1 layouts") {
+	auto plugin = blink::Plugin{};
+	REQUIRE(blink::exchange_api_version(&plugin, 1) == BLINK_API_VERSION);
+	std::vector<blink_Position> block_positions(10);
+	// Whatever follows the host's structs in memory is junk to it, so
+	// fill the fields it doesn't have with junk
+	blink_SampleInfo sample_info;
+	std::memset(&sample_info, 0xab, sizeof(sample_info));
+	sample_info.id           = {7};
+	sample_info.num_channels = {2};
+	sample_info.num_frames   = {1000};
+	struct {
+		blink::compat::v1::SamplerVaryingData data;
+		std::array<uint8_t, sizeof(blink_SamplerVaryingData)> junk;
+	} sampler_varying;
+	std::memset(&sampler_varying, 0xab, sizeof(sampler_varying));
+	sampler_varying.data.base.vector_id  = {3};
+	sampler_varying.data.base.positions  = block_positions.data();
+	sampler_varying.data.base.param_data = {};
+	sampler_varying.data.sample_info     = &sample_info;
+	sampler_varying.data.analysis_ready  = {BLINK_TRUE};
+	const auto host_sampler_varying = reinterpret_cast<const blink_SamplerVaryingData*>(&sampler_varying.data);
+	const auto check_sampler_varying = [&](const blink_SamplerVaryingData* varying) {
+		CHECK(varying->base.vector_id.value == 3);
+		CHECK(varying->base.positions == block_positions.data());
+		CHECK(varying->base.ramp.count == 0);
+		CHECK(varying->analysis_ready.value == BLINK_TRUE);
+		REQUIRE(varying->sample_info != nullptr);
+		CHECK(varying->sample_info->id.value == 7);
+		CHECK(varying->sample_info->num_channels.value == 2);
+		CHECK(varying->sample_info->num_frames.value == 1000);
+		CHECK(varying->sample_info->channel_data == nullptr);
+		CHECK(varying->sample_info->get_data_raw == nullptr);
+		CHECK(varying->sample_info->read_ahead == nullptr);
+	};
+	SUBCASE("sampler process") {
+		CHECK(blink::entry::sampler_process(plugin, host_sampler_varying, [&](const blink_SamplerVaryingData* varying) {
+			check_sampler_varying(varying);
+			return BLINK_OK;
+		}) == BLINK_OK);
+	}
+	SUBCASE("sampler draw") {
+		std::vector<float> amp(10);
+		blink_SamplerDrawInfo out;
+		std::memset(&out, 0xab, sizeof(out));
+		std::memset(&out, 0, offsetof(blink_SamplerDrawInfo, peak_min));
+		out.amp = amp.data();
+		CHECK(blink::entry::sampler_draw(plugin, host_sampler_varying, &out, [&](const blink_SamplerVaryingData* varying, blink_SamplerDrawInfo* plugin_out) {
+			check_sampler_varying(varying);
+			CHECK(plugin_out->amp == amp.data());
+			CHECK(plugin_out->final_sample_positions == nullptr);
+			CHECK(plugin_out->peak_min == nullptr);
+			CHECK(plugin_out->peak_max == nullptr);
+			CHECK(plugin_out->peak_rms == nullptr);
+			return BLINK_OK;
+		}) == BLINK_OK);
+	}
+	SUBCASE("sampler analysis") {
+		CHECK(blink::entry::sampler_analyze_sample(plugin, &sample_info, [&](const blink_SampleInfo* info) {
+			CHECK(info->id.value == 7);
+			CHECK(info->channel_data == nullptr);
+			CHECK(info->get_data_raw == nullptr);
+			CHECK(info->read_ahead == nullptr);
+			return blink_AnalysisResult_OK;
+		}) == blink_AnalysisResult_OK);
+	}
+	SUBCASE("effect and synth process") {
+		struct {
+			blink::compat::v1::VaryingData data;
+			std::array<uint8_t, sizeof(blink_VaryingData)> junk;
+		} varying;
+		std::memset(&varying, 0xab, sizeof(varying));
+		varying.data.vector_id  = {3};
+		varying.data.positions  = block_positions.data();
+		varying.data.param_data = {};
+		const auto host_varying = reinterpret_cast<const blink_VaryingData*>(&varying.data);
+		const auto check_varying = [&](const blink_VaryingData* varying) {
+			CHECK(varying->vector_id.value == 3);
+			CHECK(varying->positions == block_positions.data());
+			CHECK(varying->ramp.count == 0);
+			return BLINK_OK;
+		};
+		CHECK(blink::entry::effect_process(plugin, host_varying, check_varying) == BLINK_OK);
+		CHECK(blink::entry::synth_process(plugin, host_varying, check_varying) == BLINK_OK);
+	}
+	SUBCASE("a current host's structs are passed straight through") {
+		REQUIRE(blink::exchange_api_version(&plugin, BLINK_API_VERSION) == BLINK_API_VERSION);
+		blink_SamplerVaryingData varying = {};
+		CHECK(blink::entry::sampler_process(plugin, &varying, [&](const blink_SamplerVaryingData* plugin_varying) {
+			CHECK(plugin_varying == &varying);
+			return BLINK_OK;
+		}) == BLINK_OK);
+	}
+}
+
+namespace {
+
+[[nodiscard]]
+auto same_bits(float a, float b) -> bool {
+	return blink::sample_store::codec::to_ordered(a) == blink::sample_store::codec::to_ordered(b);
+}
+
+// Encodes and decodes [frames], whole and in pieces, and checks every
+// frame comes back with exactly the same bits. Returns the block.
+auto check_round_trip(const std::vector<float>& frames) -> blink::sample_store::EncodedBlock {
+	namespace codec = blink::sample_store::codec;
+	const auto block = codec::encode(frames.data(), int(frames.size()));
+	std::vector<float> out(frames.size());
+	codec::decode(block, out.data());
+	auto mismatches = 0;
+	for (size_t i = 0; i < frames.size(); i++) {
+		mismatches += same_bits(out[i], frames[i]) ? 0 : 1;
+	}
+	CHECK(mismatches == 0);
+	const auto first = int(frames.size() / 3);
+	const auto count = int(frames.size() / 2);
+	std::vector<float> part(count);
+	codec::decode(block, first, count, part.data());
+	mismatches = 0;
+	for (int i = 0; i < count; i++) {
+		mismatches += same_bits(part[i], frames[first + i]) ? 0 : 1;
+	}
+	CHECK(mismatches == 0);
+	return block;
+}
+
+} // namespace
+
+TEST_CASE("sample store blocks decode to exactly what was encoded") {
+	constexpr auto N = blink::sample_store::BLOCK_FRAMES;
+	auto rng   = std::mt19937{5};
+	auto noise = std::normal_distribution<float>{0.0f, 0.3f};
+	std::vector<float> frames(N);
+	for (int i = 0; i < N; i++) {
+		frames[i] = (0.5f * std::sin(float(i) * 0.02f)) + (0.2f * std::sin(float(i) * 0.131f));
+	}
+	SUBCASE("float") {
+		CHECK(check_round_trip(frames).shift == 0);
+	}
+	SUBCASE("float noise") {
+		for (auto& x : frames) x = noise(rng);
+		CHECK(check_round_trip(frames).shift == 0);
+	}
+	SUBCASE("silence") {
+		frames.assign(N, 0.0f);
+		CHECK(check_round_trip(frames).words.size() <= size_t(N / 32) + 1);
+	}
+	SUBCASE("16-bit source") {
+		for (auto& x : frames) x = std::round(x * 32768.0f) / 32768.0f;
+		frames[0] = -1.0f;
+		CHECK(check_round_trip(frames).shift == 15);
+	}
+	SUBCASE("16-bit noise") {
+		for (auto& x : frames) x = std::round(std::clamp(noise(rng), -1.0f, 1.0f) * 32767.0f) / 32768.0f;
+		CHECK(check_round_trip(frames).shift == 15);
+	}
+	SUBCASE("24-bit source") {
+		for (auto& x : frames) x = std::round(x * 8388608.0f) / 8388608.0f;
+		CHECK(check_round_trip(frames).shift == 23);
+	}
+	SUBCASE("an integer source with a negative zero isn't coded as integers") {
+		for (auto& x : frames) x = std::round(x * 32768.0f) / 32768.0f;
+		frames[100] = -0.0f;
+		CHECK(check_round_trip(frames).shift == 0);
+	}
+	SUBCASE("short final block") {
+		frames.resize(1234);
+		check_round_trip(frames);
+		frames.resize(1);
+		check_round_trip(frames);
+	}
+	SUBCASE("NaNs, infinities and denormals") {
+		const auto inf = std::numeric_limits<float>::infinity();
+		const auto nan = std::numeric_limits<float>::quiet_NaN();
+		const auto min = std::numeric_limits<float>::denorm_min();
+		const auto specials = std::vector<float>{nan, -nan, inf, -inf, -0.0f, min, -min, min * 1000.0f, std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+		for (int i = 0; i < N; i++) {
+			if (i % 7 == 0) frames[i] = specials[(i / 7) % specials.size()];
+		}
+		// Prediction through a run of them too
+		std::fill(frames.begin() + 2000, frames.begin() + 2010, nan);
+		std::fill(frames.begin() + 3000, frames.begin() + 3010, min);
+		CHECK(check_round_trip(frames).shift == 0);
+	}
+}
+
+TEST_CASE("sample store reads are right before the background decoder catches up") {
+	using namespace std::chrono_literals;
+	constexpr auto N = uint64_t(20000);
+	std::vector<float> left(N);
+	std::vector<float> right(N);
+	for (uint64_t i = 0; i < N; i++) {
+		left[i]  = std::sin(float(i) * 0.01f);
+		right[i] = std::round(std::cos(float(i) * 0.013f) * 16384.0f) / 32768.0f;
+	}
+	const float* channels[] = {left.data(), right.data()};
+	auto store  = blink::SampleStore{8};
+	auto source = store.add({1}, {2}, {N}, channels);
+	std::vector<float> buffer(5000);
+	const auto check_read = [&](uint8_t channel, uint64_t index, uint64_t size) {
+		REQUIRE(blink::SampleStore::get_data(&source, {channel}, {index}, {size}, buffer.data()).value == std::min(size, N - index));
+		const auto& expected = channel == 0 ? left : right;
+		auto mismatches = 0;
+		for (uint64_t i = 0; i < std::min(size, N - index); i++) {
+			mismatches += same_bits(buffer[i], expected[index + i]) ? 0 : 1;
+		}
+		CHECK(mismatches == 0);
+	};
+	// Straddles two blocks, neither of which is cached yet
+	check_read(0, 4000, 1000);
+	CHECK(store.get_stats().misses == 2);
+	check_read(1, 19000, 5000);
+	for (int tries = 0; tries < 1000 && store.get_stats().loads < 3; tries++) {
+		std::this_thread::sleep_for(1ms);
+	}
+	REQUIRE(store.get_stats().loads >= 3);
+	store.reset_stats();
+	check_read(0, 4000, 1000);
+	CHECK(store.get_stats().hits == 2);
+	CHECK(store.get_stats().misses == 0);
+	CHECK(blink::SampleStore::get_data(&source, {2}, {0}, {10}, buffer.data()).value == 0);
+	CHECK(blink::SampleStore::get_data(&source, {0}, {N}, {10}, buffer.data()).value == 0);
+}
+
+namespace {
+
+// A pitch envelope, warp points and reverse points, any of which can be
+// left out
+struct TapeSetup {
+	std::vector<blink_RealPoint> pitch_points;
+	std::vector<blink_WarpPoint> warp_points;
+	std::vector<blink_IntPoint> reverse_points;
+	blink_UniformEnvData pitch = {};
+	blink_WarpPoints warp = {};
+	blink_UniformOptionData reverse = {};
+	draw::TapeConfig config = {};
+	TapeSetup(std::mt19937* rng, int trial) {
+		pitch_points   = make_real_points(rng, -12.0f, 12.0f);
+		warp_points    = make_warp_points(rng);
+		reverse_points = make_reverse_points(rng);
+		pitch          = make_env(&pitch_points, -24.0f, 24.0f);
+		warp           = blink_WarpPoints{warp_points.size(), warp_points.data()};
+		reverse        = make_option(&reverse_points);
+		config.tape.unit_state_id = uint64_t(trial + 1);
+		config.tape.transpose     = 1.5f;
+		config.tape.sample_offset = 13;
+		config.sr_ratio           = 1.25;
+		if (trial % 4 != 1) config.tape.env.pitch = &pitch;
+		if (trial % 3 != 1) config.tape.warp_points = &warp;
+		if (trial % 5 != 1) config.tape.option.reverse = &reverse;
+	}
+	TapeSetup(const TapeSetup&) = delete;
+};
+
+// Every output of a draw, as blink_SamplerDrawInfo wants them
+struct DrawOutputs {
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> values;
+	blink_SamplerDrawInfo info = {};
+	DrawOutputs(uint64_t n, uint64_t channels) {
+		const auto info_positions = draw_stream::get_position_outputs(&info);
+		const auto info_values    = draw_stream::get_value_outputs(&info);
+		for (size_t i = 0; i < positions.size(); i++) {
+			positions[i].resize(n);
+			*info_positions[i] = positions[i].data();
+		}
+		for (int i = 0; i < int(values.size()); i++) {
+			values[i].resize(n * draw_stream::get_value_rows(i, channels));
+			*info_values[i] = values[i].data();
+		}
+	}
+	DrawOutputs(const DrawOutputs&) = delete;
+};
+
+// Puts the chunks of a streamed draw back together
+struct JoinedChunks {
+	uint64_t n;
+	uint64_t channels;
+	bool float_positions;
+	int stop_after = -1;
+	int chunks     = 0;
+	uint64_t next  = 0;
+	std::array<std::vector<double>, 5> positions;
+	std::array<std::vector<float>, 5> values;
+	JoinedChunks(uint64_t n, uint64_t channels, bool float_positions)
+		: n{n}
+		, channels{channels}
+		, float_positions{float_positions}
+	{
+		for (auto& output : positions) output.assign(n, -1.0);
+		for (int i = 0; i < int(values.size()); i++) {
+			values[i].assign(n * draw_stream::get_value_rows(i, channels), -1.0f);
+		}
+	}
+	static auto sink(void* user, const blink_SamplerDrawChunk* chunk) -> blink_Bool {
+		auto& self = *static_cast<JoinedChunks*>(user);
+		const auto count = chunk->count.value;
+		CHECK(chunk->first == self.next);
+		auto info                  = chunk->data;
+		auto float_info            = chunk->float_data;
+		const auto chunk_positions = draw_stream::get_position_outputs(&info);
+		const auto chunk_floats    = draw_stream::get_position_outputs(&float_info);
+		const auto chunk_values    = draw_stream::get_value_outputs(&info);
+		for (size_t i = 0; i < self.positions.size(); i++) {
+			for (uint64_t j = 0; j < count; j++) {
+				self.positions[i][chunk->first + j] = self.float_positions ? double((*chunk_floats[i])[j]) : (*chunk_positions[i])[j];
+			}
+		}
+		for (int i = 0; i < int(self.values.size()); i++) {
+			for (uint64_t row = 0; row < draw_stream::get_value_rows(i, self.channels); row++) {
+				std::copy_n(*chunk_values[i] + (row * count), count, self.values[i].begin() + (row * self.n) + chunk->first);
+			}
+		}
+		self.next = chunk->first + count;
+		return {++self.chunks != self.stop_after};
+	}
+};
+
+} // namespace
+
+TEST_CASE("streamed tape draws join up into the same draw as draw::tape") {
+	constexpr auto N        = uint64_t(4321);
+	constexpr auto CHANNELS = uint64_t(2);
+	std::mt19937 rng(8);
+	auto value = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+	std::vector<float> left(40000), right(40000);
+	for (auto& x : left) x = value(rng);
+	for (auto& x : right) x = value(rng) * 0.5f;
+	const float* const channel_data[] = {left.data(), right.data()};
+	blink_SampleInfo info = {};
+	info.id           = {1};
+	info.num_channels = {uint8_t(CHANNELS)};
+	info.num_frames   = {left.size()};
+	info.channel_data = channel_data;
+	PeakPyramid pyramid;
+	REQUIRE(pyramid.build(nullptr, {}, info) == blink_AnalysisResult_OK);
+	// Unevenly spaced, so that each pixel's peak depends on its neighbours
+	std::vector<blink_Position> block_positions(N);
+	for (uint64_t i = 0; i < N; i++) {
+		block_positions[i] = (double(i) * 3.7) + (double(i) * double(i) * 0.001) - 200.0;
+	}
+	blink_VaryingData varying = {};
+	varying.positions = block_positions.data();
+	const auto draw_amp = [](const blink_VaryingData& varying, blink_FrameCount n, float* out) {
+		for (uint64_t i = 0; i < n.value; i++) {
+			out[i] = float(varying.positions[i]) * 0.5f;
+		}
+	};
+	for (int trial = 0; trial < 6; trial++) {
+		CAPTURE(trial);
+		TapeSetup setup{&rng, trial};
+		setup.config.peak_pyramid = &pyramid;
+		DrawOutputs expected{N, CHANNELS};
+		draw::tape(nullptr, setup.config, varying, {N}, expected.info);
+		draw_amp(varying, {N}, expected.values[1].data());
+		const auto stream_draw = [&](WorkerPool* pool, uint64_t chunk_size, bool float_positions, int stop_after) {
+			auto joined = JoinedChunks{N, CHANNELS, float_positions};
+			joined.stop_after = stop_after;
+			blink_SamplerDrawStream stream = {};
+			stream.outputs         = (1u << 10) - 1;
+			stream.float_positions = {float_positions};
+			stream.chunk_size      = {chunk_size};
+			stream.user            = &joined;
+			stream.sink            = &JoinedChunks::sink;
+			REQUIRE(draw::tape_stream(pool, setup.config, varying, {N}, stream, draw_amp) == BLINK_OK);
+			return joined;
+		};
+		const auto check_joined = [&](const JoinedChunks& joined, uint64_t end) {
+			for (size_t i = 0; i < expected.positions.size(); i++) {
+				CAPTURE(i);
+				auto mismatches = 0;
+				for (uint64_t j = 0; j < end; j++) {
+					const auto x = joined.float_positions ? double(float(expected.positions[i][j])) : expected.positions[i][j];
+					mismatches += joined.positions[i][j] == x ? 0 : 1;
+				}
+				CHECK(mismatches == 0);
+			}
+			for (int i = 0; i < int(expected.values.size()); i++) {
+				CAPTURE(i);
+				auto mismatches = 0;
+				for (uint64_t row = 0; row < draw_stream::get_value_rows(i, CHANNELS); row++) {
+					for (uint64_t j = 0; j < end; j++) {
+						mismatches += joined.values[i][(row * N) + j] == expected.values[i][(row * N) + j] ? 0 : 1;
+					}
+				}
+				CHECK(mismatches == 0);
+			}
+		};
+		SUBCASE("chunks which don't divide the draw") {
+			const auto joined = stream_draw(nullptr, 1000, false, -1);
+			CHECK(joined.chunks == 5);
+			CHECK(joined.next == N);
+			check_joined(joined, N);
+		}
+		SUBCASE("one pixel chunks") {
+			const auto joined = stream_draw(nullptr, 1, false, -1);
+			CHECK(joined.chunks == int(N));
+			check_joined(joined, N);
+		}
+		SUBCASE("the default chunk size, on a worker pool") {
+			WorkerPool pool{2};
+			const auto joined = stream_draw(&pool, 0, false, -1);
+			CHECK(joined.next == N);
+			check_joined(joined, N);
+		}
+		SUBCASE("float positions") {
+			const auto joined = stream_draw(nullptr, 777, true, -1);
+			CHECK(joined.next == N);
+			check_joined(joined, N);
+		}
+		SUBCASE("a sink which stops early") {
+			const auto joined = stream_draw(nullptr, 1000, false, 2);
+			CHECK(joined.chunks == 2);
+			CHECK(joined.next == 2000);
+			check_joined(joined, 2000);
+		}
+	}
+}
+
+TEST_CASE("interpolated tape draws are within the tolerance of the exact draw") {
+	constexpr auto N = uint64_t(20000);
+	struct Ramp {
+		double start;
+		double step;
+	};
+	// The first crosses every pitch, warp and reverse point. The second is
+	// zoomed in, so that most pixels are interpolated.
+	const Ramp ramps[] = {{-500.0, 1.1}, {2000.25, 0.013}};
+	const double tolerances[] = {0.5, 0.01};
+	std::mt19937 rng(9);
+	auto interpolated = uint64_t(0);
+	for (int trial = 0; trial < 12; trial++) {
+		CAPTURE(trial);
+		TapeSetup setup{&rng, trial};
+		const auto& ramp = ramps[trial % 2];
+		blink_VaryingData varying = {};
+		varying.ramp.start = ramp.start;
+		varying.ramp.step  = ramp.step;
+		varying.ramp.count = int(N);
+		DrawOutputs expected{N, 1};
+		draw::tape(nullptr, setup.config, varying, {N}, expected.info);
+		for (const auto tolerance : tolerances) {
+			CAPTURE(tolerance);
+			auto config = setup.config;
+			config.tolerance = tolerance;
+			DrawOutputs drawn{N, 1};
+			draw::tape(nullptr, config, varying, {N}, drawn.info);
+			for (size_t i = 0; i < expected.positions.size(); i++) {
+				CAPTURE(i);
+				// The block positions are the sample positions over sr_ratio
+				const auto is_block = i == 2 || i == 3;
+				const auto limit    = is_block ? tolerance / config.sr_ratio : tolerance;
+				auto worst = 0.0;
+				for (uint64_t j = 0; j < N; j++) {
+					const auto error = std::abs(drawn.positions[i][j] - expected.positions[i][j]);
+					worst = std::max(worst, error);
+					interpolated += error > 0.0 ? 1 : 0;
+				}
+				CHECK(worst <= limit);
+			}
+		}
+	}
+	// Otherwise nothing was tested
+	CHECK(interpolated > 0);
 }